@@ -0,0 +1,156 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// Benchmark for chunks with far more than 256 constants, where
+// every load needs OP_CONSTANT_LONG or an OP_WIDE instruction.
+//
+// Build it from the repository root:
+//
+//   cc -O2 -I. -o constants bench/constants.c chunk.c compiler.c
+//      debug.c memory.c object.c profiler.c scanner.c simd.c value.c
+//      vm.c
+//
+// Then run `./constants > /dev/null` (the results go to stderr).
+//
+// It first compiles a script with 100k distinct number literals.
+// Everything made of literals alone gets folded, so the script
+// multiplies nil by each one to keep them all in the pool - it's
+// only compiled, never run. Then it runs hand built chunks that sum
+// 100k distinct constants, loading them three ways.
+
+#include "common.h"
+#include "chunk.h"
+#include "compiler.h"
+#include "vm.h"
+
+#define CONSTANTS 100000
+#define ITERATIONS 200
+
+static double now() {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return time.tv_sec * 1e9 + time.tv_nsec;
+}
+
+// Every constant is different, so none of them get deduplicated.
+static double constantValue(int i) {
+  return i + 0.5;
+}
+
+static void compileScript() {
+  // "nil * 0.5 + nil * 1.5 + ..."
+  size_t capacity = (size_t) CONSTANTS * 32;
+  char *source = malloc(capacity);
+  size_t length = 0;
+
+  for (int i = 0; i < CONSTANTS; i++) {
+    length += snprintf(source + length, capacity - length, "%snil * %g",
+                       i == 0 ? "" : " + ", constantValue(i));
+  }
+
+  Chunk chunk;
+  initChunk(&chunk);
+
+  double start = now();
+  bool compiled = compile(source, &chunk);
+  double elapsed = now() - start;
+
+  fprintf(stderr, "compile: %s, %.2f ms for %zu bytes, %d constants, "
+          "%d bytes of code\n", compiled ? "ok" : "failed", elapsed / 1e6,
+          length, chunk.constants.count, chunk.count);
+
+  freeChunk(&chunk);
+  free(source);
+}
+
+typedef enum {
+  // OP_CONSTANT + OP_ADD, cycling through the first 256 constants.
+  // The baseline.
+  LOAD_SHORT,
+
+  // OP_CONSTANT_LONG + OP_ADD.
+  LOAD_LONG,
+
+  // OP_WIDE OP_ADD_CONSTANT.
+  LOAD_WIDE
+} LoadKind;
+
+static void writeLong(Chunk *chunk, uint32_t operand) {
+  writeChunk(chunk, (uint8_t) (operand & 0xff), 1, 1);
+  writeChunk(chunk, (uint8_t) ((operand >> 8) & 0xff), 1, 1);
+  writeChunk(chunk, (uint8_t) ((operand >> 16) & 0xff), 1, 1);
+}
+
+// Builds 0.5 + 1.5 + 2.5 ... and returns the instruction count.
+static long buildChunk(Chunk *chunk, LoadKind kind) {
+  initChunk(chunk);
+
+  for (int i = 0; i < CONSTANTS; i++)
+    addConstant(chunk, NUMBER_VAL(constantValue(i)));
+
+  writeChunk(chunk, OP_CONSTANT, 1, 1);
+  writeChunk(chunk, 0, 1, 1);
+  long instructions = 1;
+
+  for (int i = 1; i < CONSTANTS; i++) {
+    switch (kind) {
+      case LOAD_SHORT:
+        writeChunk(chunk, OP_CONSTANT, 1, 1);
+        writeChunk(chunk, (uint8_t) (i % 256), 1, 1);
+        writeChunk(chunk, OP_ADD, 1, 1);
+        instructions += 2;
+        break;
+
+      case LOAD_LONG:
+        writeChunk(chunk, OP_CONSTANT_LONG, 1, 1);
+        writeLong(chunk, i);
+        writeChunk(chunk, OP_ADD, 1, 1);
+        instructions += 2;
+        break;
+
+      case LOAD_WIDE:
+        writeChunk(chunk, OP_WIDE, 1, 1);
+        writeChunk(chunk, OP_ADD_CONSTANT, 1, 1);
+        writeLong(chunk, i);
+        instructions++;
+        break;
+    }
+  }
+
+  writeChunk(chunk, OP_RETURN, 1, 1);
+
+  // The running total and the next constant.
+  chunk->maxStack = 2;
+  return instructions + 1;
+}
+
+static void runChunk(char *name, LoadKind kind) {
+  Chunk chunk;
+  long instructions = buildChunk(&chunk, kind);
+
+  double start = now();
+  for (int i = 0; i < ITERATIONS; i++)
+    interpretChunk(&chunk, NULL);
+
+  double elapsed = now() - start;
+
+  fprintf(stderr, "%-6s %6.3f ns/constant, %6.3f ns/instruction, "
+          "%d bytes of code\n", name,
+          elapsed / ((double) CONSTANTS * ITERATIONS),
+          elapsed / ((double) instructions * ITERATIONS), chunk.count);
+
+  freeChunk(&chunk);
+}
+
+int main() {
+  compileScript();
+
+  initVM();
+  runChunk("short", LOAD_SHORT);
+  runChunk("long", LOAD_LONG);
+  runChunk("wide", LOAD_WIDE);
+  freeVM();
+
+  return 0;
+}
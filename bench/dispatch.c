@@ -0,0 +1,82 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// Micro-benchmark for the run() loop's instruction dispatch.
+//
+// Build it twice from the repository root to compare the two
+// dispatch modes:
+//
+//   cc -O2 -I. -o dispatch bench/dispatch.c chunk.c compiler.c
+//      debug.c memory.c object.c profiler.c scanner.c simd.c value.c
+//      vm.c
+//   cc -O2 -I. -DLOXIM_NO_COMPUTED_GOTO -o dispatch-switch
+//      bench/dispatch.c chunk.c compiler.c debug.c memory.c object.c
+//      profiler.c scanner.c simd.c value.c vm.c
+//
+// Then run `./dispatch > /dev/null` (the results go to stderr).
+
+#include "common.h"
+#include "chunk.h"
+#include "vm.h"
+
+// Number of (constant, operator) pairs in the benchmark chunk.
+#define OPERATIONS 4096
+#define ITERATIONS 20000
+
+static double now() {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return time.tv_sec * 1e9 + time.tv_nsec;
+}
+
+int main() {
+  Chunk chunk;
+  initChunk(&chunk);
+
+  // 1 + 2 * 3 - 4 / ... but flattened, so every operator works
+  // on the running total: ((1 + 2) * 3) - 4 ...
+  OpCode operators[] = {OP_ADD, OP_MULTIPLY, OP_SUBTRACT, OP_DIVIDE};
+  // Keep the pool in single-byte OP_CONSTANT range.
+  for (int i = 0; i < 200; i++)
+    addConstant(&chunk, NUMBER_VAL(i + 1));
+
+  writeChunk(&chunk, OP_CONSTANT, 1, 1);
+  writeChunk(&chunk, 0, 1, 1);
+
+  for (int i = 0; i < OPERATIONS; i++) {
+    writeChunk(&chunk, OP_CONSTANT, 1, 1);
+    writeChunk(&chunk, (uint8_t) (i % 200), 1, 1);
+    writeChunk(&chunk, operators[i % 4], 1, 1);
+  }
+
+  writeChunk(&chunk, OP_RETURN, 1, 1);
+
+  // The running total and the next constant.
+  chunk.maxStack = 2;
+
+  // Every pair is two instructions, plus the first constant and
+  // the return.
+  long instructions = (long) OPERATIONS * 2 + 2;
+
+  initVM();
+
+  double start = now();
+  for (int i = 0; i < ITERATIONS; i++)
+    interpretChunk(&chunk, NULL);
+
+  double elapsed = now() - start;
+
+  fprintf(stderr, "%s dispatch: %.3f ns/instruction (%ld instructions)\n",
+#ifdef COMPUTED_GOTO
+          "computed goto",
+#else
+          "switch",
+#endif
+          elapsed / ((double) instructions * ITERATIONS),
+          instructions * ITERATIONS);
+
+  freeVM();
+  freeChunk(&chunk);
+  return 0;
+}
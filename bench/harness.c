@@ -0,0 +1,257 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Times each stage of running a script separately - readFile(),
+// scanning, compile() and running the compiled chunk - and reports
+// how long one pass of each takes and what it allocates. Meant for
+// tracking regressions from one release to the next.
+//
+// Build it with `make bench`, or from the repository root:
+//
+//   cc -O2 -I. -o harness bench/harness.c chunk.c compiler.c debug.c
+//      memory.c object.c profiler.c scanner.c simd.c source.c value.c
+//      vm.c
+//
+// Then run `./harness [--time ms] script...`, or `make bench-run` for
+// the whole corpus in bench/corpus. Every stage is repeated until it
+// has taken at least --time milliseconds (200 by default), and at
+// least MIN_ITERATIONS times.
+//
+// Results go to stdout, one JSON object per script and stage:
+//
+//   {"script": "bench/corpus/arithmetic.lox", "stage": "compile",
+//    "bytes": 5120, "iterations": 9000, "ns_per_op": 21500.0,
+//    "ns_min": 20900.0, "allocs_per_op": 6.0,
+//    "alloc_bytes_per_op": 16912.0, "result": "ok"}
+//
+// ns_per_op is the median of all the iterations. A table of the same
+// numbers goes to stderr. Scripts that don't compile have no "run"
+// stage.
+//
+// Allocations are counted with the memory stats, which stay on for
+// the whole run. The times include what counting costs, so only
+// compare them with other numbers from this harness.
+
+#include "common.h"
+#include "chunk.h"
+#include "compiler.h"
+#include "memory.h"
+#include "scanner.h"
+#include "source.h"
+#include "vm.h"
+
+#define MIN_ITERATIONS 5
+#define MAX_ITERATIONS 1000000
+
+static double now() {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return time.tv_sec * 1e9 + time.tv_nsec;
+}
+
+// Everything the stages share for one script.
+typedef struct {
+  char *path;
+
+  // Loaded once up front, for the stages after readFile().
+  Source source;
+
+  // Compiled once up front, for the run stage.
+  Arena arena;
+  Chunk chunk;
+  bool isCompiled;
+
+  VM vm;
+} Script;
+
+// Does one pass of a stage, and returns how it went.
+typedef char *(*Stage)(Script *);
+
+static char *readStage(Script *script) {
+  Source source = readFile(script->path);
+  freeSource(&source);
+  return "ok";
+}
+
+static char *scanStage(Script *script) {
+  initScanner(script->source.text);
+
+  bool hadError = false;
+
+  while (1) {
+    Token token = scanToken();
+    if (token.type == TOKEN_EOF)
+      break;
+
+    if (token.type == TOKEN_ERROR)
+      hadError = true;
+  }
+
+  return hadError ? "scan error" : "ok";
+}
+
+static char *compileStage(Script *script) {
+  Arena arena;
+  initArena(&arena);
+
+  Chunk chunk;
+  initChunk(&chunk);
+  setChunkArena(&chunk, &arena);
+
+  bool compiled = compile(script->source.text, &chunk);
+
+  freeChunk(&chunk);
+  freeArena(&arena);
+
+  return compiled ? "ok" : "compile error";
+}
+
+static char *runStage(Script *script) {
+  InterpretResult result = vmInterpretChunk(&script->vm, &script->chunk,
+                                            script->source.text);
+
+  return result == INTERPRET_OK ? "ok" : "runtime error";
+}
+
+static int compareTimes(const void *a, const void *b) {
+  double left = *(double *) a;
+  double right = *(double *) b;
+
+  return left < right ? -1 : left > right ? 1 : 0;
+}
+
+// Where the results go. Not stdout itself - see main().
+static FILE *results;
+
+static void printJsonString(char *string) {
+  fputc('"', results);
+
+  for (char *c = string; *c != '\0'; c++) {
+    if (*c == '"' || *c == '\\')
+      fputc('\\', results);
+
+    fputc(*c, results);
+  }
+
+  fputc('"', results);
+}
+
+static void bench(Script *script, char *name, Stage stage, double budget,
+                  double *times) {
+
+  // One pass first, so the caches are warm and the first iteration
+  // isn't the odd one out.
+  stage(script);
+
+  MemTotals before = getMemTotals();
+  double total = 0;
+  int iterations = 0;
+  char *result = NULL;
+
+  while (iterations < MIN_ITERATIONS ||
+         (total < budget && iterations < MAX_ITERATIONS)) {
+
+    double start = now();
+    result = stage(script);
+    double elapsed = now() - start;
+
+    times[iterations++] = elapsed;
+    total += elapsed;
+  }
+
+  MemTotals after = getMemTotals();
+
+  qsort(times, iterations, sizeof (double), compareTimes);
+  double median = times[iterations / 2];
+  double allocs = (double) (after.calls - before.calls) / iterations;
+  double bytes = (double) (after.allocated - before.allocated) /
+                 iterations;
+
+  fprintf(results, "{\"script\": ");
+  printJsonString(script->path);
+  fprintf(results, ", \"stage\": \"%s\", \"bytes\": %zu, "
+          "\"iterations\": %d, \"ns_per_op\": %.1f, \"ns_min\": %.1f, "
+          "\"allocs_per_op\": %.1f, \"alloc_bytes_per_op\": %.1f, "
+          "\"result\": \"%s\"}\n", name, script->source.length, 
+          iterations, median, times[0], allocs, bytes, result);
+
+  fprintf(stderr, "%-32s %-8s %9d %14.1f %14.1f %10.1f %14.1f  %s\n",
+          script->path, name, iterations, median, times[0], allocs,
+          bytes, result);
+}
+
+int main(int argc, char **argv) {
+  // Before anything is allocated, or the early bytes are missed.
+  enableMemStats();
+
+  double budget = 200 * 1e6;
+  int first = 1;
+
+  if (argc > 2 && strcmp(argv[1], "--time") == 0) {
+    budget = atof(argv[2]) * 1e6;
+    first = 3;
+  }
+
+  if (first >= argc) {
+    fprintf(stderr, "Usage: harness [--time ms] script...\n");
+    return 64;
+  }
+
+  double *times = malloc(sizeof (double) * MAX_ITERATIONS);
+
+  // Running a script prints what it returns, which mustn't end up
+  // in the middle of the results. They get their own copy of stdout,
+  // and the real one is thrown away.
+  results = fdopen(dup(fileno(stdout)), "w");
+  if (results == NULL || freopen("/dev/null", "w", stdout) == NULL) {
+    fprintf(stderr, "Could not set up stdout for the results.\n");
+    return 74;
+  }
+
+  // Compile and runtime errors are part of what's measured, but
+  // nobody needs to read thousands of copies of them.
+  FILE *errors = fopen("/dev/null", "w");
+  setErrorOutput(errors);
+
+  fprintf(stderr, "%-32s %-8s %9s %14s %14s %10s %14s  %s\n", "script",
+          "stage", "runs", "ns/op", "min ns", "allocs/op", "bytes/op",
+          "result");
+
+  for (int i = first; i < argc; i++) {
+    Script script;
+    script.path = argv[i];
+    script.source = readFile(script.path);
+
+    initArena(&script.arena);
+    initChunk(&script.chunk);
+    setChunkArena(&script.chunk, &script.arena);
+    script.isCompiled = compile(script.source.text, &script.chunk);
+
+    vmInit(&script.vm);
+    if (errors != NULL)
+      script.vm.errors = errors;
+
+    bench(&script, "read", readStage, budget, times);
+    bench(&script, "scan", scanStage, budget, times);
+    bench(&script, "compile", compileStage, budget, times);
+
+    if (script.isCompiled)
+      bench(&script, "run", runStage, budget, times);
+
+    vmFree(&script.vm);
+    freeChunk(&script.chunk);
+    freeArena(&script.arena);
+    freeSource(&script.source);
+  }
+
+  setErrorOutput(NULL);
+  if (errors != NULL)
+    fclose(errors);
+
+  fclose(results);
+  free(times);
+  return 0;
+}
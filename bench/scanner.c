@@ -0,0 +1,131 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Scanner throughput, in MB/s, on generated sources: one that looks
+// like hand-written code, one with the long runs of whitespace,
+// comments and strings generated code tends to have, and one that's
+// nothing but keywords and identifiers.
+//
+// Build it from the repository root, with and without the
+// vectorized fast paths:
+//
+//   cc -O2 -I. -o scanner bench/scanner.c memory.c scanner.c simd.c
+//   cc -O2 -I. -DLOXIM_NO_SIMD -o scanner-scalar bench/scanner.c
+//      memory.c scanner.c simd.c
+//
+// Both print a checksum of every token's type, line, column and
+// length, which must match.
+
+#include "common.h"
+#include "scanner.h"
+
+#define SOURCE_SIZE (16 * 1024 * 1024)
+#define ITERATIONS 20
+
+static double now() {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return time.tv_sec * 1e9 + time.tv_nsec;
+}
+
+static char *generateSource(char **pieces, int pieceCount, size_t size) {
+  char *source = malloc(size + 1);
+  size_t length = 0;
+
+  for (int i = 0; ; i = (i + 1) % pieceCount) {
+    size_t pieceLength = strlen(pieces[i]);
+    if (length + pieceLength > size)
+      break;
+
+    memcpy(source + length, pieces[i], pieceLength);
+    length += pieceLength;
+  }
+
+  source[length] = '\0';
+  return source;
+}
+
+static void bench(char *name, char *source) {
+  size_t length = strlen(source);
+
+  uint64_t checksum = 0;
+  long tokens = 0;
+  double best = 0;
+
+  for (int i = 0; i < ITERATIONS; i++) {
+    checksum = 0;
+    tokens = 0;
+
+    double start = now();
+    initScanner(source);
+
+    while (1) {
+      Token token = scanToken();
+      checksum = checksum * 31 + (uint64_t) token.type;
+      checksum = checksum * 31 + (uint64_t) token.line;
+      checksum = checksum * 31 + (uint64_t) token.column;
+      checksum = checksum * 31 + (uint64_t) token.length;
+      tokens++;
+
+      if (token.type == TOKEN_EOF)
+        break;
+    }
+
+    double elapsed = now() - start;
+    double throughput = length / (elapsed / 1e9) / (1024 * 1024);
+    if (throughput > best)
+      best = throughput;
+  }
+
+  printf("%-6s %7.1f MB/s (%ld tokens, checksum %016llx)\n", name, best, 
+         tokens, (unsigned long long) checksum);
+}
+
+int main() {
+  // Typical code: short tokens, a bit of everything.
+  char *code[] = {
+    "        someRatherLongIdentifier_42 + anotherOne * (x1 - y2)\n",
+    "    // A comment explaining what the next line does, at length.\n",
+    "  \"a string literal with some words in it\" + \"another\"\n",
+    "\t\tvar snake_case_name = CamelCaseName / 3.14159;\r\n",
+    "  if (condition) print \"multi\nline\nstring\";  // trailing\n",
+  };
+
+  // Generated code: deep indentation, banner comments, long 
+  // names and long strings.
+  char *wide[] = {
+    "                                                                "
+    "generated_identifier_with_a_very_long_name_000000000000000001\n",
+    "// ============================================================="
+    "==============================================================\n",
+    "                                \"Lorem ipsum dolor sit amet, "
+    "consectetur adipiscing elit, sed do eiusmod tempor incididunt\"\n",
+  };
+
+  // Keywords and identifiers, most of them looking like keywords.
+  char *words[] = {
+    "if else while for fun var class this super return print nil and\n",
+    "or true false switch case default in instanceof nmut value item\n",
+    "iffy elsewhere whiles format funny variable classes thistle\n",
+    "superb returns printer nilly android orbit trueness falsetto\n",
+  };
+
+  char *source = generateSource(code, sizeof (code) / sizeof (code[0]), 
+                                SOURCE_SIZE);
+  bench("code", source);
+  free(source);
+
+  source = generateSource(wide, sizeof (wide) / sizeof (wide[0]), 
+                          SOURCE_SIZE);
+  bench("wide", source);
+  free(source);
+
+  source = generateSource(words, sizeof (words) / sizeof (words[0]), 
+                          SOURCE_SIZE);
+  bench("words", source);
+  free(source);
+
+  return 0;
+}
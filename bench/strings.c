@@ -0,0 +1,185 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Benchmark for interned strings: what interning costs when a
+// string is made, and what it saves every time two strings are
+// compared.
+//
+// Build it with `make bench`, or from the repository root:
+//
+//   cc -O2 -I. -o strings bench/strings.c chunk.c compiler.c debug.c
+//      memory.c object.c profiler.c scanner.c simd.c value.c vm.c
+//
+// Then run `./strings > /dev/null` (the results go to stderr).
+//
+// The strings all share a long prefix and only differ at the end,
+// which is the worst case for comparing characters - and makes no
+// difference to comparing pointers.
+
+#include "common.h"
+#include "chunk.h"
+#include "object.h"
+#include "vm.h"
+
+#define STRINGS 200
+#define PREFIX "a-rather-long-shared-prefix-for-every-key-"
+
+#define INTERN_COUNT 100000
+#define GROUPS 2048
+#define ITERATIONS 20000
+#define COMPARISONS 50000000
+
+static double now() {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return time.tv_sec * 1e9 + time.tv_nsec;
+}
+
+static int makeKey(char *buffer, size_t size, int i) {
+  return snprintf(buffer, size, PREFIX "%d", i);
+}
+
+// copyString() for strings it hasn't seen, then for the same ones
+// again, which only finds them.
+static void benchIntern() {
+  // Formatted up front, so snprintf() isn't what's being timed.
+  static char keys[INTERN_COUNT][64];
+  static int lengths[INTERN_COUNT];
+
+  for (int i = 0; i < INTERN_COUNT; i++)
+    lengths[i] = makeKey(keys[i], sizeof (keys[i]), i);
+
+  double start = now();
+  for (int i = 0; i < INTERN_COUNT; i++)
+    copyString(keys[i], lengths[i]);
+
+  double created = now() - start;
+
+  start = now();
+  for (int i = 0; i < INTERN_COUNT; i++)
+    copyString(keys[i], lengths[i]);
+
+  double found = now() - start;
+
+  fprintf(stderr, "intern   new %.1f ns, existing %.1f ns\n",
+          created / INTERN_COUNT, found / INTERN_COUNT);
+}
+
+// Builds true == ("k1" == "k2") == ("k3" == "k4") ..., so every
+// group runs one string OP_EQUAL and one boolean one. About a
+// quarter of the pairs are equal. Returns the instruction count.
+static long buildChunk(Chunk *chunk) {
+  char buffer[64];
+
+  initChunk(chunk);
+  for (int i = 0; i < STRINGS; i++) {
+    int length = makeKey(buffer, sizeof (buffer), i % (STRINGS / 2));
+    addConstant(chunk, OBJ_VAL(copyString(buffer, length)));
+  }
+
+  writeChunk(chunk, OP_TRUE, 1, 1);
+  long instructions = 1;
+
+  for (int i = 0; i < GROUPS; i++) {
+    uint8_t a = (uint8_t) (i % STRINGS);
+    uint8_t b = (uint8_t) ((i * 7 + (i & 1) * 93) % STRINGS);
+
+    writeChunk(chunk, OP_CONSTANT, 1, 1);
+    writeChunk(chunk, a, 1, 1);
+    writeChunk(chunk, OP_CONSTANT, 1, 1);
+    writeChunk(chunk, b, 1, 1);
+    writeChunk(chunk, OP_EQUAL, 1, 1);
+    writeChunk(chunk, OP_EQUAL, 1, 1);
+    instructions += 4;
+  }
+
+  writeChunk(chunk, OP_RETURN, 1, 1);
+
+  // The running result, plus the two strings.
+  chunk->maxStack = 3;
+  return instructions + 1;
+}
+
+static void benchRun() {
+  Chunk chunk;
+  long instructions = buildChunk(&chunk);
+
+  double start = now();
+  for (int i = 0; i < ITERATIONS; i++)
+    interpretChunk(&chunk, NULL);
+
+  double elapsed = now() - start;
+
+  fprintf(stderr, "run      %6ld instructions, %.3f us/run, "
+          "%.2f ns/instruction\n", instructions,
+          elapsed / ITERATIONS / 1e3,
+          elapsed / ITERATIONS / instructions);
+
+  freeChunk(&chunk);
+}
+
+// What OP_EQUAL would have to do per comparison without interning,
+// next to what it does.
+static void benchCompare() {
+  char buffer[64];
+  ObjString *interned[STRINGS];
+  char *copies[STRINGS];
+  int lengths[STRINGS];
+
+  for (int i = 0; i < STRINGS; i++) {
+    int length = makeKey(buffer, sizeof (buffer), i % (STRINGS / 2));
+    interned[i] = copyString(buffer, length);
+
+    copies[i] = malloc(length + 1);
+    if (copies[i] == NULL)
+      exit(1);
+
+    memcpy(copies[i], buffer, length + 1);
+    lengths[i] = length;
+  }
+
+  // Counting matches keeps the loops from being optimized away.
+  long matches = 0;
+
+  double start = now();
+  for (long i = 0; i < COMPARISONS; i++) {
+    int a = i % STRINGS;
+    int b = (i * 7) % STRINGS;
+
+    matches += lengths[a] == lengths[b] &&
+               memcmp(copies[a], copies[b], lengths[a]) == 0;
+  }
+
+  double byChars = now() - start;
+
+  start = now();
+  for (long i = 0; i < COMPARISONS; i++) {
+    int a = i % STRINGS;
+    int b = (i * 7) % STRINGS;
+
+    matches += interned[a] == interned[b];
+  }
+
+  double byPointer = now() - start;
+
+  fprintf(stderr, "compare  characters %.2f ns, pointers %.2f ns "
+          "(%ld matches)\n", byChars / COMPARISONS,
+          byPointer / COMPARISONS, matches);
+
+  for (int i = 0; i < STRINGS; i++)
+    free(copies[i]);
+}
+
+int main() {
+  initVM();
+
+  benchIntern();
+  benchRun();
+  benchCompare();
+
+  freeVM();
+  freeObjects();
+  return 0;
+}
@@ -0,0 +1,101 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// Compares the same arithmetic chunk with and without the fused
+// OP_*_CONSTANT superinstructions.
+//
+// Build it from the repository root:
+//
+//   cc -O2 -I. -o superinstructions bench/superinstructions.c chunk.c
+//      compiler.c debug.c memory.c object.c profiler.c scanner.c simd.c
+//      value.c vm.c
+//
+// Then run `./superinstructions > /dev/null` (the results go to stderr).
+
+#include "common.h"
+#include "chunk.h"
+#include "vm.h"
+
+#define GROUPS 2048
+#define ITERATIONS 20000
+
+static double now() {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return time.tv_sec * 1e9 + time.tv_nsec;
+}
+
+// Builds 1 + (a + b) * c + (d + e) * f ..., either as OP_CONSTANT
+// + operator pairs or as superinstructions. Each group only joins
+// the running total at the end, so groups don't have to wait for
+// each other. Returns the instruction count.
+static long buildChunk(Chunk *chunk, bool fused) {
+  initChunk(chunk);
+  for (int i = 0; i < 200; i++)
+    addConstant(chunk, NUMBER_VAL((i + 1) / 100.0));
+
+  writeChunk(chunk, OP_CONSTANT, 1, 1);
+  writeChunk(chunk, 0, 1, 1);
+  long instructions = 1;
+
+  for (int i = 0; i < GROUPS; i++) {
+    uint8_t a = (uint8_t) (i % 200);
+    uint8_t b = (uint8_t) ((i + 1) % 200);
+    uint8_t c = (uint8_t) ((i + 2) % 200);
+
+    writeChunk(chunk, OP_CONSTANT, 1, 1);
+    writeChunk(chunk, a, 1, 1);
+
+    if (fused) {
+      writeChunk(chunk, OP_ADD_CONSTANT, 1, 1);
+      writeChunk(chunk, b, 1, 1);
+      writeChunk(chunk, OP_MULTIPLY_CONSTANT, 1, 1);
+      writeChunk(chunk, c, 1, 1);
+      instructions += 3;
+    } else {
+      writeChunk(chunk, OP_CONSTANT, 1, 1);
+      writeChunk(chunk, b, 1, 1);
+      writeChunk(chunk, OP_ADD, 1, 1);
+      writeChunk(chunk, OP_CONSTANT, 1, 1);
+      writeChunk(chunk, c, 1, 1);
+      writeChunk(chunk, OP_MULTIPLY, 1, 1);
+      instructions += 5;
+    }
+
+    writeChunk(chunk, OP_ADD, 1, 1);
+    instructions++;
+  }
+
+  writeChunk(chunk, OP_RETURN, 1, 1);
+
+  // The running total, plus a and b while they're being added.
+  chunk->maxStack = 3;
+  return instructions + 1;
+}
+
+static void bench(char *name, bool fused) {
+  Chunk chunk;
+  long instructions = buildChunk(&chunk, fused);
+
+  double start = now();
+  for (int i = 0; i < ITERATIONS; i++)
+    interpretChunk(&chunk, NULL);
+
+  double elapsed = now() - start;
+
+  fprintf(stderr, "%-8s %6ld instructions, %7d bytes, %.3f us/run\n", name, 
+          instructions, chunk.count, elapsed / ITERATIONS / 1e3);
+
+  freeChunk(&chunk);
+}
+
+int main() {
+  initVM();
+
+  bench("plain", false);
+  bench("fused", true);
+
+  freeVM();
+  return 0;
+}
@@ -0,0 +1,126 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+// Benchmark for running one VM per thread.
+//
+// Every thread gets its own VM and its own chunk, and runs it over
+// and over. With nothing shared between them, the total throughput
+// should grow in line with the number of threads, up to the number
+// of cores. Build it from the repository root:
+//
+//   cc -O2 -I. -pthread -o threads bench/threads.c chunk.c
+//      compiler.c debug.c memory.c object.c profiler.c scanner.c simd.c
+//      value.c vm.c
+//
+// Then run `./threads > /dev/null` (the results go to stderr). An
+// optional argument sets the most threads to try - twice the number
+// of cores by default.
+
+#include "common.h"
+#include "chunk.h"
+#include "vm.h"
+
+// Number of (constant, operator) pairs in each thread's chunk.
+#define OPERATIONS 4096
+#define ITERATIONS 5000
+
+static double now() {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return time.tv_sec * 1e9 + time.tv_nsec;
+}
+
+// Same shape as the chunk in dispatch.c - every operator works on
+// the running total.
+static void buildChunk(Chunk *chunk) {
+  OpCode operators[] = {OP_ADD, OP_MULTIPLY, OP_SUBTRACT, OP_DIVIDE};
+
+  // Keep the pool in single-byte OP_CONSTANT range.
+  for (int i = 0; i < 200; i++)
+    addConstant(chunk, NUMBER_VAL(i + 1));
+
+  writeChunk(chunk, OP_CONSTANT, 1, 1);
+  writeChunk(chunk, 0, 1, 1);
+
+  for (int i = 0; i < OPERATIONS; i++) {
+    writeChunk(chunk, OP_CONSTANT, 1, 1);
+    writeChunk(chunk, (uint8_t) (i % 200), 1, 1);
+    writeChunk(chunk, operators[i % 4], 1, 1);
+  }
+
+  writeChunk(chunk, OP_RETURN, 1, 1);
+
+  // The running total and the next constant.
+  chunk->maxStack = 2;
+}
+
+static void *worker(void *arg) {
+  (void) arg;
+
+  VM vm;
+  vmInit(&vm);
+
+  Chunk chunk;
+  initChunk(&chunk);
+  buildChunk(&chunk);
+
+  for (int i = 0; i < ITERATIONS; i++)
+    vmInterpretChunk(&vm, &chunk, NULL);
+
+  freeChunk(&chunk);
+  vmFree(&vm);
+  return NULL;
+}
+
+// Runs [count] workers at once and returns how long they took, in
+// nanoseconds.
+static double runWorkers(int count) {
+  pthread_t *threads = malloc(sizeof (pthread_t) * count);
+
+  double start = now();
+
+  for (int i = 0; i < count; i++)
+    pthread_create(&threads[i], NULL, worker, NULL);
+
+  for (int i = 0; i < count; i++)
+    pthread_join(threads[i], NULL);
+
+  double elapsed = now() - start;
+
+  free(threads);
+  return elapsed;
+}
+
+int main(int argc, char **argv) {
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  if (cores < 1)
+    cores = 1;
+
+  int maxThreads = argc > 1 ? atoi(argv[1]) : (int) cores * 2;
+  if (maxThreads < 1)
+    maxThreads = 1;
+
+  // Every pair is two instructions, plus the first constant and
+  // the return.
+  double instructions = ((double) OPERATIONS * 2 + 2) * ITERATIONS;
+
+  fprintf(stderr, "%ld cores\n", cores);
+
+  double single = 0;
+
+  for (int count = 1; count <= maxThreads; count *= 2) {
+    double elapsed = runWorkers(count);
+    double throughput = instructions * count / elapsed * 1e3;
+
+    if (count == 1)
+      single = throughput;
+
+    fprintf(stderr, "%3d threads: %8.1f M instructions/s (%.2fx)\n",
+            count, throughput, throughput / single);
+  }
+
+  return 0;
+}
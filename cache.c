@@ -0,0 +1,406 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "cache.h"
+#include "memory.h"
+#include "object.h"
+
+// The layout of a cache file:
+//
+// [CacheHeader]
+// [positions]  uint8_t * header.positionSize
+// [constants]  uint8_t * header.constantSize, header.constantCount
+//              constants back to back
+// [code]       uint8_t * header.count
+//
+// Everything is written in the machine's own byte order. A cache
+// made on a different machine fails the magic check and is just
+// recompiled.
+//
+// Only the encoded bytes of the position table go on disk. Its
+// checkpoints are rebuilt while it's decoded, which also checks it.
+
+#define CACHE_MAGIC   0x43584f4c // "LOXC"
+
+// Bump this whenever the format or the instruction set changes.
+#define CACHE_VERSION 6
+
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t sourceHash;
+  int32_t count;
+  int32_t positionSize;
+  int32_t constantCount;
+  int32_t constantSize;
+} CacheHeader;
+
+// Constants are tagged on disk, so a cache doesn't depend on
+// whether the VM was built with NAN_BOXING. Most are a tag byte and
+// a double (unused for nil, true and false). Strings are a tag byte,
+// an int32_t length and their characters, and are interned again 
+// when they're read.
+typedef enum {
+  CONST_NIL,
+  CONST_FALSE,
+  CONST_TRUE,
+  CONST_NUMBER,
+  CONST_STRING
+} ConstantTag;
+
+#define CONSTANT_SIZE        (1 + sizeof (double))
+#define STRING_CONSTANT_SIZE (1 + sizeof (int32_t))
+
+uint64_t hashSource(char *source, size_t length) {
+  // 64-bit FNV-1a.
+  uint64_t hash = 14695981039346656037u;
+
+  for (size_t i = 0; i < length; i++) {
+    hash ^= (uint8_t) source[i];
+    hash *= 1099511628211u;
+  }
+
+  return hash;
+}
+
+char *cachePath(char *path) {
+  // script.lox -> script.loxc, anything else gets a .loxc suffix.
+  size_t length = strlen(path);
+  bool isLox = length > 4 && strcmp(path + length - 4, ".lox") == 0;
+  char *suffix = isLox ? "c" : ".loxc";
+
+  char *result = malloc(length + strlen(suffix) + 1);
+  if (result == NULL)
+    exit(1);
+
+  memcpy(result, path, length);
+  strcpy(result + length, suffix);
+  return result;
+}
+
+// The whole cache file, mapped (or read) into memory.
+typedef struct {
+  uint8_t *data;
+  size_t size;
+} CacheFile;
+
+static bool openCache(char *path, CacheFile *file) {
+#ifndef _WIN32
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return false;
+
+  struct stat info;
+  if (fstat(fd, &info) < 0 || info.st_size == 0) {
+    close(fd);
+    return false;
+  }
+
+  file->size = (size_t) info.st_size;
+  file->data = mmap(NULL, file->size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+  // The mapping stays valid after the descriptor is closed.
+  close(fd);
+  return file->data != MAP_FAILED;
+#else
+  FILE *handle = fopen(path, "rb");
+  if (handle == NULL)
+    return false;
+
+  fseek(handle, 0L, SEEK_END);
+  file->size = ftell(handle);
+  rewind(handle);
+
+  file->data = malloc(file->size);
+  if (file->data == NULL || 
+      fread(file->data, 1, file->size, handle) < file->size) {
+
+    free(file->data);
+    fclose(handle);
+    return false;
+  }
+
+  fclose(handle);
+  return true;
+#endif
+}
+
+static void closeCache(CacheFile *file) {
+#ifndef _WIN32
+  munmap(file->data, file->size);
+#else
+  free(file->data);
+#endif
+}
+
+// Decodes the constant at the start of [data], which has [size]
+// bytes left. Returns how many bytes it took up, or 0 if it's
+// invalid.
+static size_t readConstant(uint8_t *data, size_t size, Value *value) {
+  double number;
+  int32_t length;
+
+  if (size < 1)
+    return 0;
+
+  if (data[0] == CONST_STRING) {
+    if (size < STRING_CONSTANT_SIZE)
+      return 0;
+
+    memcpy(&length, data + 1, sizeof (int32_t));
+    if (length < 0 || (size_t) length > size - STRING_CONSTANT_SIZE)
+      return 0;
+
+    *value = OBJ_VAL(copyString((char *) data + STRING_CONSTANT_SIZE,
+                                length));
+
+    return STRING_CONSTANT_SIZE + length;
+  }
+
+  if (size < CONSTANT_SIZE)
+    return 0;
+
+  switch (data[0]) {
+    case CONST_NIL:   *value = NIL_VAL;         break;
+    case CONST_FALSE: *value = BOOL_VAL(false); break;
+    case CONST_TRUE:  *value = BOOL_VAL(true);  break;
+    case CONST_NUMBER:
+      memcpy(&number, data + 1, sizeof (double));
+      *value = NUMBER_VAL(number);
+      break;
+
+    default:
+      return 0;
+  }
+
+  return CONSTANT_SIZE;
+}
+
+bool readCachedChunk(uint8_t *data, size_t size, uint64_t sourceHash, 
+                     Chunk *chunk) {
+
+  CacheHeader header;
+  if (size < sizeof (CacheHeader))
+    return false;
+
+  memcpy(&header, data, sizeof (CacheHeader));
+
+  if (header.magic != CACHE_MAGIC || header.version != CACHE_VERSION ||
+      header.sourceHash != sourceHash || header.count <= 0 ||
+      header.positionSize <= 0 || header.constantCount < 0 ||
+      header.constantSize < 0) {
+
+    return false;
+  }
+
+  size_t positionsSize = header.positionSize;
+  size_t constantsSize = header.constantSize;
+  size_t codeSize = header.count;
+
+  // A truncated or padded file can't be trusted.
+  if (size != sizeof (CacheHeader) + positionsSize + constantsSize + 
+              codeSize) {
+
+    return false;
+  }
+
+  uint8_t *positions = data + sizeof (CacheHeader);
+  uint8_t *constants = positions + positionsSize;
+  uint8_t *code = constants + constantsSize;
+
+  // Decode the constants, which can turn out to be invalid. They
+  // have to fill their section exactly.
+  size_t constantOffset = 0;
+
+  for (int i = 0; i < header.constantCount; i++) {
+    Value value;
+    size_t used = readConstant(constants + constantOffset, 
+                               constantsSize - constantOffset, &value);
+
+    if (used == 0) {
+      freeChunk(chunk);
+      return false;
+    }
+
+    constantOffset += used;
+    writeValueArray(&chunk->constants, value);
+  }
+
+  if (constantOffset != constantsSize) {
+    freeChunk(chunk);
+    return false;
+  }
+
+  // The code is copied as-is, into an array freeChunk() knows how 
+  // to free.
+  chunk->count = chunk->capacity = header.count;
+  chunk->code = GROW_ARRAY_IN(chunk->arena, uint8_t, NULL, 0, header.count);
+  memcpy(chunk->code, code, codeSize);
+
+  // The position table is decoded against it, and checked too. So
+  // is the code itself - a chunk the VM trusts blindly could make it
+  // read or write anywhere.
+  if (!readPositions(chunk, positions, header.positionSize)) {
+    freeChunk(chunk);
+    return false;
+  }
+
+  // The VM makes room for maxStack values and never checks again, so
+  // it's worked out from the code rather than read from the file.
+  chunk->maxStack = verifyChunk(chunk);
+  if (chunk->maxStack < 0) {
+    freeChunk(chunk);
+    return false;
+  }
+
+  return true;
+}
+
+bool loadCache(char *path, uint64_t sourceHash, Chunk *chunk) {
+  CacheFile file;
+  if (!openCache(path, &file))
+    return false;
+
+  bool loaded = readCachedChunk(file.data, file.size, sourceHash, chunk);
+
+  closeCache(&file);
+  return loaded;
+}
+
+// How many bytes [value] takes up on disk.
+static size_t constantSize(Value value) {
+  if (IS_STRING(value))
+    return STRING_CONSTANT_SIZE + AS_STRING(value)->length;
+
+  return CONSTANT_SIZE;
+}
+
+bool writeCachedChunk(FILE *file, uint64_t sourceHash, Chunk *chunk) {
+  size_t constantsSize = 0;
+  for (int i = 0; i < chunk->constants.count; i++)
+    constantsSize += constantSize(chunk->constants.values[i]);
+
+  if (constantsSize > INT32_MAX)
+    return false;
+
+  CacheHeader header;
+  memset(&header, 0, sizeof (CacheHeader));
+  header.magic = CACHE_MAGIC;
+  header.version = CACHE_VERSION;
+  header.sourceHash = sourceHash;
+  header.count = chunk->count;
+  header.positionSize = chunk->positions.byteCount;
+  header.constantCount = chunk->constants.count;
+  header.constantSize = (int32_t) constantsSize;
+
+  bool ok = fwrite(&header, sizeof (CacheHeader), 1, file) == 1;
+  ok = ok && fwrite(chunk->positions.bytes, 1, chunk->positions.byteCount,
+                    file) == (size_t) chunk->positions.byteCount;
+
+  for (int i = 0; ok && i < chunk->constants.count; i++) {
+    Value value = chunk->constants.values[i];
+    uint8_t constant[CONSTANT_SIZE];
+    memset(constant, 0, CONSTANT_SIZE);
+
+    if (IS_STRING(value)) {
+      // The characters follow the tag and the length.
+      ObjString *string = AS_STRING(value);
+      constant[0] = CONST_STRING;
+      memcpy(constant + 1, &string->length, sizeof (int32_t));
+
+      ok = fwrite(constant, STRING_CONSTANT_SIZE, 1, file) == 1 &&
+           fwrite(string->chars, 1, string->length, file) == 
+           (size_t) string->length;
+
+      continue;
+    }
+
+    if (IS_NIL(value)) {
+      constant[0] = CONST_NIL;
+    } else if (IS_BOOL(value)) {
+      constant[0] = AS_BOOL(value) ? CONST_TRUE : CONST_FALSE;
+    } else {
+      double number = AS_NUMBER(value);
+      constant[0] = CONST_NUMBER;
+      memcpy(constant + 1, &number, sizeof (double));
+    }
+
+    ok = fwrite(constant, CONSTANT_SIZE, 1, file) == 1;
+  }
+
+  ok = ok && fwrite(chunk->code, 1, chunk->count, file) == 
+             (size_t) chunk->count;
+
+  return ok;
+}
+
+// Creates a file with a unique name starting with [path], which is
+// turned into that name.
+static FILE *openTemporary(char *path) {
+#ifndef _WIN32
+  int fd = mkstemp(path);
+  if (fd < 0)
+    return NULL;
+
+  // mkstemp() makes it private to us, unlike the fopen()ed caches
+  // this replaces.
+  fchmod(fd, 0644);
+
+  FILE *file = fdopen(fd, "wb");
+  if (file == NULL) {
+    close(fd);
+    remove(path);
+  }
+
+  return file;
+#else
+  if (_mktemp_s(path, strlen(path) + 1) != 0)
+    return NULL;
+
+  return fopen(path, "wb");
+#endif
+}
+
+void writeCache(char *path, uint64_t sourceHash, Chunk *chunk) {
+  // The cache is written next to where it goes and renamed into
+  // place, so there's never a half-written one to load - not after
+  // an interrupted run, and not while another run (or another
+  // --check thread) is writing the same one.
+  size_t length = strlen(path);
+  char *temporary = malloc(length + sizeof (".XXXXXX"));
+  if (temporary == NULL)
+    exit(1);
+
+  memcpy(temporary, path, length);
+  strcpy(temporary + length, ".XXXXXX");
+
+  FILE *file = openTemporary(temporary);
+  if (file == NULL) {
+    free(temporary);
+    return;
+  }
+
+  bool ok = writeCachedChunk(file, sourceHash, chunk);
+  ok = fclose(file) == 0 && ok;
+
+#ifdef _WIN32
+  // rename() won't replace an existing file here.
+  if (ok)
+    remove(path);
+#endif
+
+  ok = ok && rename(temporary, path) == 0;
+
+  if (!ok)
+    remove(temporary);
+
+  free(temporary);
+}
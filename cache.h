@@ -0,0 +1,42 @@
+#ifndef CLOXIM_CACHE_H
+#define CLOXIM_CACHE_H
+
+#include <stdio.h>
+
+#include "common.h"
+#include "chunk.h"
+
+// Compiled chunks can be saved next to their script, so the next
+// run of an unchanged script doesn't have to scan and compile it
+// all over again.
+
+// Hashes source code, to tell if a cache is still up to date.
+uint64_t hashSource(char *, size_t);
+
+// Retrieves the path of a script's cache file. The caller
+// must free() it.
+char *cachePath(char *);
+
+// Loads the chunk cached at [path] into an initialized chunk.
+// Returns false if there's no cache, if it was made from a 
+// different source, or if it's damaged - its code is checked with
+// verifyChunk() before it's trusted.
+bool loadCache(char *, uint64_t, Chunk *);
+
+// Writes [chunk] to [path]. Failing to do so isn't an error - 
+// we'll just compile the script again next time.
+void writeCache(char *, uint64_t, Chunk *);
+
+// The same format, for chunks stored inside other files - like
+// execution traces, which carry the chunk they ran.
+
+// Writes [chunk] in cache format at the current position in [file].
+// Returns false if it couldn't all be written.
+bool writeCachedChunk(FILE *, uint64_t, Chunk *);
+
+// Loads a chunk written by writeCachedChunk() from [size] bytes of
+// memory, which must be exactly what it wrote. Returns false if
+// it's anything else, including code that isn't safe to run.
+bool readCachedChunk(uint8_t *, size_t, uint64_t, Chunk *);
+
+#endif
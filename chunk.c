@@ -9,15 +9,154 @@ void initChunk(Chunk *chunk) {
   chunk->count = 0;
   chunk->capacity = 0;
   chunk->code = NULL;
-  chunk->lineCount = 0;
-  chunk->lineCapacity = 0;
-  chunk->lines = NULL;
-  chunk->columns = NULL;
+  chunk->positions.count = 0;
+  chunk->positions.byteCount = 0;
+  chunk->positions.byteCapacity = 0;
+  chunk->positions.bytes = NULL;
+  chunk->positions.checkpointCount = 0;
+  chunk->positions.checkpointCapacity = 0;
+  chunk->positions.checkpoints = NULL;
+  chunk->positions.lastOffset = 0;
+  chunk->positions.last = (Position) {0, 0};
+  chunk->maxStack = 0;
+  chunk->lineIndexStamp = 0;
+  chunk->arena = NULL;
+  chunk->constantSlotCapacity = 0;
+  chunk->constantSlots = NULL;
 
   // Initialize the constant pool.
   initValueArray(&chunk->constants);  
 }
 
+void setChunkArena(Chunk *chunk, Arena *arena) {
+  chunk->arena = arena;
+  chunk->constants.arena = arena;
+}
+
+static void writePositionByte(Chunk *chunk, uint8_t byte) {
+  PositionTable *table = &chunk->positions;
+
+  if (table->byteCapacity < table->byteCount + 1) {
+    int oldCapacity = table->byteCapacity;
+    table->byteCapacity = GROW_CAPACITY(oldCapacity);
+    table->bytes = GROW_ARRAY_IN(chunk->arena, uint8_t, table->bytes,
+                                 oldCapacity, table->byteCapacity);
+  }
+
+  table->bytes[table->byteCount++] = byte;
+}
+
+// Writes [value] seven bits at a time, lowest first. The top bit of
+// each byte says whether another one follows.
+static void writeVarint(Chunk *chunk, uint32_t value) {
+  while (value >= 0x80) {
+    writePositionByte(chunk, (uint8_t) (value | 0x80));
+    value >>= 7;
+  }
+
+  writePositionByte(chunk, (uint8_t) value);
+}
+
+static uint32_t readVarint(uint8_t *bytes, int *index) {
+  uint32_t value = 0;
+  int shift = 0;
+
+  while (1) {
+    uint8_t byte = bytes[(*index)++];
+    value |= (uint32_t) (byte & 0x7f) << shift;
+
+    if (byte < 0x80)
+      return value;
+
+    shift += 7;
+  }
+}
+
+// Small negative deltas map to small numbers too: 0, -1, 1, -2...
+static uint32_t zigzag(int value) {
+  return ((uint32_t) value << 1) ^ (uint32_t) (value >> 31);
+}
+
+static int unzigzag(uint32_t value) {
+  return (int) (value >> 1) ^ -(int) (value & 1);
+}
+
+static void addPosition(Chunk *chunk, int offset, int line, int column) {
+  PositionTable *table = &chunk->positions;
+
+  writeVarint(chunk, offset - table->lastOffset);
+  writeVarint(chunk, zigzag(line - table->last.line));
+  writeVarint(chunk, zigzag(column - table->last.column));
+
+  if (table->count % POSITION_CHECKPOINT == 0) {
+    if (table->checkpointCapacity < table->checkpointCount + 1) {
+      int oldCapacity = table->checkpointCapacity;
+      table->checkpointCapacity = GROW_CAPACITY(oldCapacity);
+      table->checkpoints = GROW_ARRAY_IN(chunk->arena, PositionCheckpoint,
+                                         table->checkpoints, oldCapacity,
+                                         table->checkpointCapacity);
+    }
+
+    PositionCheckpoint *checkpoint = 
+      &table->checkpoints[table->checkpointCount++];
+
+    checkpoint->offset = offset;
+    checkpoint->position = (Position) {line, column};
+    checkpoint->next = table->byteCount;
+  }
+
+  table->count++;
+  table->lastOffset = offset;
+  table->last = (Position) {line, column};
+}
+
+// Finds the last entry at or before [offset], by binary searching
+// the checkpoints and decoding forward from the closest one. Returns
+// its number, or -1 if the first entry comes after [offset].
+static int seekPosition(PositionTable *table, int offset, int *entryOffset,
+                        Position *position, int *next) {
+
+  int start = 0;
+  int end = table->checkpointCount - 1;
+  int found = -1;
+
+  while (start <= end) {
+    int mid = (start + end) / 2;
+
+    if (table->checkpoints[mid].offset <= offset) {
+      found = mid;
+      start = mid + 1;
+    } else {
+      end = mid - 1;
+    }
+  }
+
+  if (found == -1)
+    return -1;
+
+  PositionCheckpoint *checkpoint = &table->checkpoints[found];
+  int entry = found * POSITION_CHECKPOINT;
+  *entryOffset = checkpoint->offset;
+  *position = checkpoint->position;
+  *next = checkpoint->next;
+
+  // Never more than POSITION_CHECKPOINT - 1 entries to go.
+  while (entry + 1 < table->count) {
+    int index = *next;
+    int nextOffset = *entryOffset + (int) readVarint(table->bytes, &index);
+    if (nextOffset > offset)
+      break;
+
+    position->line += unzigzag(readVarint(table->bytes, &index));
+    position->column += unzigzag(readVarint(table->bytes, &index));
+    *entryOffset = nextOffset;
+    *next = index;
+    entry++;
+  }
+
+  return entry;
+}
+
 void writeChunk(Chunk *chunk, uint8_t byte, int line, int column) {
   if (chunk->capacity < chunk->count + 1) {
     // That means we need to grow our array
@@ -27,35 +166,23 @@ void writeChunk(Chunk *chunk, uint8_t byte, int line, int column) {
     chunk->capacity = GROW_CAPACITY(oldCapacity);
 
     // Now grow the array
-    chunk->code = GROW_ARRAY(uint8_t, chunk->code, oldCapacity, 
-                            chunk->capacity);
-
-    chunk->columns = GROW_ARRAY(int, chunk->columns, oldCapacity, 
-                          chunk->capacity);
-
+    chunk->code = GROW_ARRAY_IN(chunk->arena, uint8_t, chunk->code, 
+                               oldCapacity, chunk->capacity);
   }
 
   // Append the byte to it.
-  chunk->code[chunk->count] = byte;
-  chunk->columns[chunk->count++] = column;
+  chunk->code[chunk->count++] = byte;
 
-  if (chunk->lineCount > 0 && chunk->lines[chunk->lineCount - 1].line == line) {
-    // If we are on the same line, we don't have to append a new one to 
-    // chunk->lines.
-    return;
-  }
+  PositionTable *table = &chunk->positions;
+  if (table->count > 0 && table->last.line == line && 
+      table->last.column == column) {
 
-  // Append to chunk->lines.
-  if (chunk->lineCapacity < chunk->lineCount + 1) {
-    int oldCapacity = chunk->lineCapacity;
-    chunk->lineCapacity = GROW_CAPACITY(oldCapacity);
-    chunk->lines = GROW_ARRAY(LineStart, chunk->lines, oldCapacity, 
-                              chunk->lineCapacity);
+    // Same place as the byte before it - most likely one of its 
+    // operands - so the last entry covers it already.
+    return;
   }
 
-  LineStart *lineStart = &chunk->lines[chunk->lineCount++];
-  lineStart->offset = chunk->count - 1;
-  lineStart->line = line;
+  addPosition(chunk, chunk->count - 1, line, column);
 }
 
 void writeConstant(Chunk *chunk, Value value, int line, int column) {
@@ -71,46 +198,358 @@ void writeConstant(Chunk *chunk, Value value, int line, int column) {
   }
 }
 
+int stackEffect(uint8_t instruction) {
+  switch (instruction) {
+    case OP_CONSTANT:
+    case OP_CONSTANT_LONG:
+    case OP_NIL:
+    case OP_TRUE:
+    case OP_FALSE:
+      return 1;
+
+    // Two operands in, one result out.
+    case OP_ADD:
+    case OP_SUBTRACT:
+    case OP_MULTIPLY:
+    case OP_DIVIDE:
+    case OP_EQUAL:
+    case OP_RETURN:
+      return -1;
+
+    // Only a prefix - the instruction after it has the effect.
+    case OP_WIDE:
+      return 0;
+
+    // These replace the top of the stack. The fused ones read their
+    // right operand from the constant pool instead of the stack.
+    default:
+      return 0;
+  }
+}
+
+// How many values an instruction needs on the stack before it runs.
+static int stackInputs(uint8_t instruction) {
+  switch (instruction) {
+    case OP_ADD:
+    case OP_SUBTRACT:
+    case OP_MULTIPLY:
+    case OP_DIVIDE:
+    case OP_EQUAL:
+      return 2;
+
+    case OP_NOT:
+    case OP_NEGATE:
+    case OP_RETURN:
+    case OP_ADD_CONSTANT:
+    case OP_SUBTRACT_CONSTANT:
+    case OP_MULTIPLY_CONSTANT:
+    case OP_DIVIDE_CONSTANT:
+      return 1;
+
+    default:
+      return 0;
+  }
+}
+
+int decodeInstruction(Chunk *chunk, int offset, uint8_t *instruction,
+                      int *operand) {
+
+  uint8_t *code = chunk->code;
+  int start = offset;
+
+  bool isWide = code[offset] == OP_WIDE;
+  if (isWide && ++offset == chunk->count)
+    return -1;
+
+  *instruction = code[offset];
+
+  int operandSize;
+  switch (*instruction) {
+    case OP_CONSTANT:
+    case OP_ADD_CONSTANT:
+    case OP_SUBTRACT_CONSTANT:
+    case OP_MULTIPLY_CONSTANT:
+    case OP_DIVIDE_CONSTANT:
+      operandSize = isWide ? 3 : 1;
+      break;
+
+    case OP_CONSTANT_LONG:
+      // Its operand is as wide as it gets already.
+      if (isWide)
+        return -1;
+
+      operandSize = 3;
+      break;
+
+    case OP_NIL:
+    case OP_TRUE:
+    case OP_FALSE:
+    case OP_ADD:
+    case OP_SUBTRACT:
+    case OP_MULTIPLY:
+    case OP_DIVIDE:
+    case OP_NOT:
+    case OP_NEGATE:
+    case OP_EQUAL:
+    case OP_RETURN:
+      operandSize = 0;
+      break;
+
+    default:
+      return -1;
+  }
+
+  // Nor can the instructions without an operand.
+  if (isWide && operandSize != 3)
+    return -1;
+
+  if (operandSize > chunk->count - offset - 1)
+    return -1;
+
+  *operand = -1;
+  if (operandSize > 0) {
+    *operand = code[offset + 1];
+    if (operandSize == 3)
+      *operand |= (code[offset + 2] << 8) | (code[offset + 3] << 16);
+  }
+
+  return offset + 1 + operandSize - start;
+}
+
+int verifyChunk(Chunk *chunk) {
+  int depth = 0;
+  int maxDepth = 0;
+  int offset = 0;
+
+  // The last instruction, without its OP_WIDE prefix.
+  uint8_t instruction = OP_WIDE;
+
+  while (offset < chunk->count) {
+    int operand;
+    int size = decodeInstruction(chunk, offset, &instruction, &operand);
+
+    // Every operand there is is a constant index.
+    if (size < 0 || operand >= chunk->constants.count)
+      return -1;
+
+    if (depth < stackInputs(instruction))
+      return -1;
+
+    depth += stackEffect(instruction);
+    if (depth > maxDepth)
+      maxDepth = depth;
+
+    offset += size;
+  }
+
+  return instruction == OP_RETURN ? maxDepth : -1;
+}
+
+// Finds [value]'s slot in [slots], or the empty one it would go in.
+static ConstantSlot *findConstantSlot(ConstantSlot *slots, int capacity,
+                                      Value *values, Value value) {
+
+  uint32_t index = hashConstant(value) & (capacity - 1);
+
+  while (1) {
+    ConstantSlot *slot = &slots[index];
+    if (slot->index == -1 || constantsEqual(values[slot->index], value))
+      return slot;
+
+    index = (index + 1) & (capacity - 1);
+  }
+}
+
+static void growConstantSlots(Chunk *chunk) {
+  int capacity = GROW_CAPACITY(chunk->constantSlotCapacity);
+  ConstantSlot *slots = GROW_ARRAY_IN(chunk->arena, ConstantSlot, NULL, 
+                                      0, capacity);
+
+  for (int i = 0; i < capacity; i++)
+    slots[i].index = -1;
+
+  for (int i = 0; i < chunk->constantSlotCapacity; i++) {
+    ConstantSlot *old = &chunk->constantSlots[i];
+    if (old->index == -1)
+      continue;
+
+    *findConstantSlot(slots, capacity, chunk->constants.values,
+                      chunk->constants.values[old->index]) = *old;
+  }
+
+  FREE_ARRAY_IN(chunk->arena, ConstantSlot, chunk->constantSlots, 
+                chunk->constantSlotCapacity);
+
+  chunk->constantSlots = slots;
+  chunk->constantSlotCapacity = capacity;
+}
+
 int addConstant(Chunk *chunk, Value value) {
-  // Write it to our constant pool.
-  writeValueArray(&chunk->constants, value);
+  // Keep the index at most 3/4 full.
+  if (chunk->constants.count + 1 > chunk->constantSlotCapacity * 3 / 4)
+    growConstantSlots(chunk);
+
+  ConstantSlot *slot = findConstantSlot(chunk->constantSlots, 
+                                        chunk->constantSlotCapacity,
+                                        chunk->constants.values, value);
+
+  if (slot->index == -1) {
+    // Write it to our constant pool.
+    writeValueArray(&chunk->constants, value);
+    slot->index = chunk->constants.count - 1;
+    slot->uses = 0;
+  }
+
+  slot->uses++;
 
   // Return its index in the constant pool.
-  return chunk->constants.count - 1;
+  return slot->index;
 }
 
-int getLine(Chunk * chunk, int instruction) {
-  // Binary search the line
-  int start = 0;
-  int end = chunk->lineCount - 1;
+void releaseConstant(Chunk *chunk, int index) {
+  Value *values = chunk->constants.values;
+  int capacity = chunk->constantSlotCapacity;
+
+  // Chunks loaded from a cache have no index.
+  if (capacity == 0)
+    return;
+
+  ConstantSlot *slot = findConstantSlot(chunk->constantSlots, capacity,
+                                        values, values[index]);
+
+  if (slot->index != index || --slot->uses > 0 || 
+      index != chunk->constants.count - 1) {
+
+    return;
+  }
+
+  chunk->constants.count--;
+
+  // Empty the slot, and move later entries of the same probe run
+  // back into the hole, so lookups don't stop short at it.
+  int hole = (int) (slot - chunk->constantSlots);
+  int next = hole;
 
   while (1) {
-    int mid = (start + end) / 2;
-    LineStart *line = &chunk->lines[mid];
+    next = (next + 1) & (capacity - 1);
+    ConstantSlot *entry = &chunk->constantSlots[next];
+    if (entry->index == -1)
+      break;
 
-    if (instruction < line->offset) {
-      end = mid - 1;
-    } else if (mid == chunk->lineCount - 1 || instruction < chunk->lines[mid + 1]
-              .offset) {
-      
-      return line->line;
-    } else {
-      start = mid + 1;
+    // Only entries whose home slot isn't between the hole and
+    // where they are can move into it.
+    int home = hashConstant(values[entry->index]) & (capacity - 1);
+    bool between = hole <= next ? (hole < home && home <= next) 
+                                : (hole < home || home <= next);
+
+    if (!between) {
+      chunk->constantSlots[hole] = *entry;
+      hole = next;
+    }
+  }
+
+  chunk->constantSlots[hole].index = -1;
+}
+
+void truncateChunk(Chunk *chunk, int offset) {
+  chunk->count = offset;
+
+  // Forget the entries that started inside the dropped bytes.
+  PositionTable *table = &chunk->positions;
+  int lastOffset = 0;
+  Position last = {0, 0};
+  int next = 0;
+  int entry = seekPosition(table, offset - 1, &lastOffset, &last, &next);
+
+  table->count = entry + 1;
+  table->byteCount = next;
+  table->checkpointCount = (table->count + POSITION_CHECKPOINT - 1) / 
+                           POSITION_CHECKPOINT;
+
+  table->lastOffset = lastOffset;
+  table->last = last;
+}
+
+// Like readVarint(), but for bytes that might be corrupt. Fails
+// instead of reading past [end], or past five bytes.
+static bool readVarintSafely(uint8_t *bytes, int end, int *index, 
+                             uint32_t *value) {
+
+  *value = 0;
+
+  for (int shift = 0; shift < 35 && *index < end; shift += 7) {
+    uint8_t byte = bytes[(*index)++];
+    *value |= (uint32_t) (byte & 0x7f) << shift;
+
+    if (byte < 0x80)
+      return true;
+  }
+
+  return false;
+}
+
+bool readPositions(Chunk *chunk, uint8_t *bytes, int length) {
+  int index = 0;
+  int offset = 0;
+  Position position = {0, 0};
+
+  while (index < length) {
+    uint32_t delta, line, column;
+
+    if (!readVarintSafely(bytes, length, &index, &delta) ||
+        !readVarintSafely(bytes, length, &index, &line) ||
+        !readVarintSafely(bytes, length, &index, &column)) {
+
+      return false;
     }
+
+    // Offsets only go forwards, and stay inside the code.
+    if ((delta == 0 && chunk->positions.count > 0) || 
+        delta >= (uint32_t) (chunk->count - offset)) {
+
+      return false;
+    }
+
+    offset += (int) delta;
+    position.line += unzigzag(line);
+    position.column += unzigzag(column);
+    addPosition(chunk, offset, position.line, position.column);
   }
+
+  return chunk->positions.count > 0;
+}
+
+Position getPosition(Chunk *chunk, int offset) {
+  int entryOffset;
+  Position position = {0, 0};
+  int next;
+
+  seekPosition(&chunk->positions, offset, &entryOffset, &position, &next);
+  return position;
+}
+
+int getLine(Chunk *chunk, int instruction) {
+  return getPosition(chunk, instruction).line;
 }
 
 void freeChunk(Chunk *chunk) {
   // Free the instruction array
-  FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
+  FREE_ARRAY_IN(chunk->arena, uint8_t, chunk->code, chunk->capacity);
 
   // Free our line and column information.
-  FREE_ARRAY(LineStart, chunk->lines, chunk->lineCapacity);
-  FREE_ARRAY(int, chunk->columns, chunk->capacity);
+  FREE_ARRAY_IN(chunk->arena, uint8_t, chunk->positions.bytes, 
+                chunk->positions.byteCapacity);
+  FREE_ARRAY_IN(chunk->arena, PositionCheckpoint, 
+                chunk->positions.checkpoints,
+                chunk->positions.checkpointCapacity);
   
   // Free our constants.
   freeValueArray(&chunk->constants);
+  FREE_ARRAY_IN(chunk->arena, ConstantSlot, chunk->constantSlots, 
+                chunk->constantSlotCapacity);
 
-  // Zero it out.
+  // Zero it out, but keep allocating from the same place.
+  Arena *arena = chunk->arena;
   initChunk(chunk);
+  setChunkArena(chunk, arena);
 }
\ No newline at end of file
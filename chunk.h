@@ -16,13 +16,80 @@ typedef enum {
   OP_DIVIDE,
   OP_NOT,
   OP_NEGATE,
-  OP_RETURN
+  OP_EQUAL,
+  OP_RETURN,
+
+  // Superinstructions - an OP_CONSTANT fused with the
+  // instruction that consumes it.
+  OP_ADD_CONSTANT,
+  OP_SUBTRACT_CONSTANT,
+  OP_MULTIPLY_CONSTANT,
+  OP_DIVIDE_CONSTANT,
+
+  // Prefix: the instruction after it takes a 3-byte operand instead
+  // of a 1-byte one - little endian, like OP_CONSTANT_LONG's:
+  //
+  // OP_WIDE OP_ADD_CONSTANT [lo] [mid] [hi]
+  //
+  // Any instruction with a 1-byte operand can be widened this way.
+  // OP_CONSTANT_LONG stays, since plain constant loads are common
+  // enough to be worth a byte less.
+  OP_WIDE
 } OpCode;
 
+// Where an instruction came from in the source.
 typedef struct {
-  int offset;
   int line;
-} LineStart;
+  int column;
+} Position;
+
+// Every POSITION_CHECKPOINT entries, the position table remembers
+// where it was, so lookups can start decoding from there instead of
+// from the beginning.
+#define POSITION_CHECKPOINT 32
+
+typedef struct {
+  // The entry's own offset and position, in full.
+  int offset;
+  Position position;
+
+  // Where the entry after it starts in the table's bytes.
+  int next;
+} PositionCheckpoint;
+
+// Source positions for a chunk's code. There's an entry wherever the
+// position changes, so at most one per instruction - operand bytes
+// share their instruction's entry. Each one is three varints, encoded
+// against the entry before it:
+//
+// [offset delta] [line delta, zigzag] [column delta, zigzag]
+//
+// Most of them take a byte each.
+typedef struct {
+  // Number of entries.
+  int count;
+
+  int byteCount;
+  int byteCapacity;
+  uint8_t *bytes;
+
+  int checkpointCount;
+  int checkpointCapacity;
+  PositionCheckpoint *checkpoints;
+
+  // The last entry, which the next one is encoded against.
+  int lastOffset;
+  Position last;
+} PositionTable;
+
+// An entry in a chunk's constant index.
+typedef struct {
+  // Where the constant is in the pool. -1 for an empty slot.
+  int index;
+
+  // How many instructions load it.
+  int uses;
+} ConstantSlot;
 
 typedef struct {
   // Current amount of slots in use in
@@ -38,28 +105,86 @@ typedef struct {
   // The chunk's constant pool.
   ValueArray constants;
 
-  // Line information - compressed with run-length
-  // encoding.
-  int lineCount;
-  int lineCapacity;
-  LineStart *lines;
+  // Hash index over [constants], so each distinct constant is only
+  // stored once, however many times it's used. Open addressing with
+  // linear probing; [constantSlotCapacity] is a power of two.
+  int constantSlotCapacity;
+  ConstantSlot *constantSlots;
+
+  // Line and column information.
+  PositionTable positions;
+
+  // The most values running this chunk ever has on the stack at
+  // once. The compiler works it out as it emits instructions, so
+  // the VM can make room for all of them before it starts. Whoever
+  // builds a chunk by hand has to set it.
+  int maxStack;
 
-  // Columns - not compressed because most instructions
-  // have a different column.
-  int *columns;
+  // The stamp of the line index built while scanning this chunk's
+  // source, so runtime errors can reuse it - see useLineIndex().
+  // 0 if the chunk didn't come from the scanner.
+  uint64_t lineIndexStamp;
+
+  // Where the arrays above are allocated. NULL for the heap.
+  Arena *arena;
 } Chunk;
 
 // Initializes a chunk.
 void initChunk(Chunk *);
 
+// Makes an empty chunk allocate everything out of [arena] from now
+// on, even after freeChunk(), which leaves the memory to freeArena().
+void setChunkArena(Chunk *, Arena *);
+
 // Writes an instruction to [chunk].
 void writeChunk(Chunk *, uint8_t, int, int);
 
 void writeConstant(Chunk *, Value, int, int);
 
-// Adds a constant to the chunk's constant pool.
+// How many values an instruction leaves on the stack, minus how
+// many it takes off. OP_WIDE is 0: for a widened instruction, pass
+// the opcode after the prefix, which has the same effect as its
+// 1-byte form.
+int stackEffect(uint8_t);
+
+// Adds a constant to the chunk's constant pool, or finds it if it's
+// there already. Returns its index.
 int addConstant(Chunk *, Value);
 
+// Says that an instruction loading the constant at [index] was
+// taken back out. If that was the last one, and the constant is the
+// last one in the pool, it's dropped. Used by the optimizer.
+void releaseConstant(Chunk *, int);
+
+// Drops every byte from [offset] onwards, along with
+// their position information. Used by the optimizer.
+void truncateChunk(Chunk *, int);
+
+// Decodes a position table written out from a chunk's
+// [positions.bytes], rebuilding the rest of it. [chunk] must have
+// its code already, and no positions yet. Returns false if the bytes
+// don't make sense for it.
+bool readPositions(Chunk *, uint8_t *, int);
+
+// Decodes the instruction at [offset], for code that might be
+// broken. [instruction] gets its opcode - the one after the prefix,
+// if it's widened - and [operand] its operand, or -1 if it has none.
+// Returns how many bytes it takes up, prefix included, or -1 if it
+// isn't an instruction the VM knows or it runs past the end.
+int decodeInstruction(Chunk *, int offset, uint8_t *instruction,
+                      int *operand);
+
+// Checks that [chunk]'s code is safe to run, for chunks that didn't
+// come from the compiler: every opcode is one the VM knows, every
+// operand is inside the code, every constant index is inside the
+// pool, no instruction takes more values off the stack than there
+// are, and it ends in OP_RETURN. Returns the most values the code
+// has on the stack at once, or -1 if it isn't safe.
+int verifyChunk(Chunk *);
+
+// Retrieves the source position of the byte at [offset].
+Position getPosition(Chunk *, int);
+
 // Retrieves an instruction's line.
 int getLine(Chunk *, int);
 
@@ -5,7 +5,34 @@
 #include <stddef.h>
 #include <stdint.h>
 
+// Pack every Value into a single 8-byte double, hiding
+// non-number values inside the unused bits of a quiet NaN.
+// Comment it out to go back to the tagged union.
+#define NAN_BOXING
+
+// Have the scanner tokenize ahead into a TokenBuffer that the
+// parser reads by index, instead of handing out one token at a
+// time. Grammar rules that need to look further ahead than the
+// current token rely on it.
+// #define BATCHED_TOKENS
+
 // #define DEBUG_PRINT_CODE
 // #define DEBUG_TRACE_EXECUTION
 
+// Dispatch instructions through a table of label addresses
+// ("computed goto", a GNU C extension) instead of a switch.
+// Define LOXIM_NO_COMPUTED_GOTO to force the portable switch.
+#if defined(__GNUC__) && !defined(LOXIM_NO_COMPUTED_GOTO)
+#define COMPUTED_GOTO
+#endif
+
+// Variables marked with this get a separate copy in every thread.
+// The scanner and compiler keep their state in these, so several
+// scripts can be compiled on different threads at the same time.
+#if defined(_MSC_VER)
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL _Thread_local
+#endif
+
 #endif
\ No newline at end of file
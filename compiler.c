@@ -5,6 +5,7 @@
 
 #include "common.h"
 #include "compiler.h"
+#include "object.h"
 #include "scanner.h"
 
 #ifdef DEBUG_PRINT_CODE
@@ -14,87 +15,133 @@
 // Like a ParseState in other implementations.
 typedef struct {
   char *source;
-  Token current;
-  Token previous;
+
+  // With BATCHED_TOKENS, in-memory sources are scanned ahead into
+  // [tokens], and the parser only keeps the indexes of its current
+  // and previous tokens - it reads whichever field it needs straight
+  // out of the buffer's arrays. Otherwise (and for streamed sources)
+  // there's no buffer: tokens come from scanToken(), and the parser
+  // keeps copies of them instead. Either way, go through
+  // currentType() and friends below.
+  TokenBuffer *tokens;
+  int current;
+  int previous;
+
+  Token currentToken;
+  Token previousToken;
+
+  // The current token's type, which the grammar checks over and
+  // over. It's the one field kept on its own, in both modes.
+  TokenType type;
+
   bool hadError;
   bool panicMode; // Error stuff.
 } Parser;
 
-Parser parser;
-Chunk *compilingChunk;
+// Each thread compiles with its own parser - see THREAD_LOCAL.
+static THREAD_LOCAL Parser parser;
+static THREAD_LOCAL Chunk *compilingChunk;
+
+// How many OP_NOTs in a row the chunk currently ends with, and
+// where that run ends. See emitNot().
+static THREAD_LOCAL int notRunLength;
+static THREAD_LOCAL int notRunEnd;
+
+// How many values the code emitted so far leaves on the stack.
+static THREAD_LOCAL int stackDepth;
+
+// Where this thread's compile errors go. NULL means stderr.
+static THREAD_LOCAL FILE *errorOutput;
+
+void setErrorOutput(FILE *output) {
+  errorOutput = output;
+}
 
 static Chunk *currentChunk() {
   return compilingChunk;
 }
 
-// Errors.
+// The parser's current and previous tokens, wherever they're kept.
+// Without BATCHED_TOKENS there's never a buffer, and the checks for
+// one fold away.
+#ifdef BATCHED_TOKENS
+#define HAS_TOKEN_BUFFER() (parser.tokens != NULL)
+#else
+#define HAS_TOKEN_BUFFER() false
+#endif
 
-// This method is not static because the VM might want to use it
-char *getOffendingLine(int line) {
-  // I looked for a better way to accomplish that and
-  // that's the only way I could find, so yes, it's 
-  // O(n).
-  
-  char *s = NULL;
-  size_t lineLen = 0;
-  int ln = 1;
-
-  // This is extreeeemely slow.
-  for (int i = 0; parser.source[i] != '\0'; i++) {
-    // I'm sorry, this thing has nested loops.
-    if (ln == line) {
-      // We are on the correct line. Now we must
-      // retrieve it.
-
-      // Calculate the length of the line.
-      while (parser.source[i] != '\n' || parser.source[i] == '\0') {
-        i++;
-        lineLen++;
-      }
-
-      // Allocate space for [s]. +1 for the null terminator.
-      s = malloc(lineLen + 1);
-
-      // "Paste" the line into s.
-      memcpy(s, parser.source + (i - lineLen), lineLen);
-      s[lineLen] = '\0';
-
-      // Retrieve it.
-      return s;
-    }
+static TokenType currentType() {
+  return parser.type;
+}
 
-    ln += parser.source[i] == '\n';
-  }
+static int currentColumn() {
+  if (HAS_TOKEN_BUFFER())
+    return getTokenColumn(parser.tokens, parser.current);
 
-  return NULL;
+  return parser.currentToken.column;
 }
 
-// source = '1 + 1\0'
-// s = NULL
-// lineLen = 0
-// ln = 1
+static int previousLine() {
+  if (HAS_TOKEN_BUFFER())
+    return getTokenLine(parser.tokens, parser.previous);
+
+  return parser.previousToken.line;
+}
+
+static int previousColumn() {
+  if (HAS_TOKEN_BUFFER())
+    return getTokenColumn(parser.tokens, parser.previous);
+
+  return parser.previousToken.column;
+}
+
+// The whole token, for when its lexeme is needed too.
+static Token currentToken() {
+  if (HAS_TOKEN_BUFFER())
+    return getToken(parser.tokens, parser.current);
+
+  return parser.currentToken;
+}
+
+static Token previousToken() {
+  if (HAS_TOKEN_BUFFER())
+    return getToken(parser.tokens, parser.previous);
+
+  return parser.previousToken;
+}
+
+// Errors.
 
 static void errorAt(Token *token, char *message) {
   // Avoid flooding errors
   if (parser.panicMode)
     return;
 
+  parser.hadError = true;
+
+  FILE *out = errorOutput != NULL ? errorOutput : stderr;
+
   int lineNumber = token->line;
-  fprintf(stderr, "Error: %s\nLine %d, ", message, lineNumber);
+  fprintf(out, "Error: %s\nLine %d, ", message, lineNumber);
 
   if (token->type == TOKEN_EOF) {
-    fprintf(stderr, "at end of file\n\n");
+    fprintf(out, "at end of file\n\n");
   } else if (token->type == TOKEN_ERROR) {
     // Nothing.
   } else {
     // This prints the token's lexeme.
-    fprintf(stderr, "at '%.*s'\n\n", token->length, token->start);
+    fprintf(out, "at '%.*s'\n\n", token->length, token->start);
   }
 
-  char *line = getOffendingLine(lineNumber);
+  // Streamed sources aren't kept around.
+  if (parser.source == NULL)
+    return;
+
+  int lineLength;
+  char *line = getOffendingLine(parser.source, lineNumber, &lineLength);
 
   if (line == NULL) {
-    fprintf(stderr, "Line is NULL.\n");
+    fprintf(out, "Line is NULL.\n");
     return;
   }
   
@@ -104,56 +151,77 @@ static void errorAt(Token *token, char *message) {
   //     15 | function(first, second,);
   //                                ^-- Here.
 
-  fprintf(stderr, "%5d | %s\n", lineNumber, line);
+  fprintf(out, "%5d | %.*s\n", lineNumber, lineLength, line);
 
   // This little extra '2' is the size of the separator between the line number
   // and the line. (" | ") (5 + 2 = 7)
-  fprintf(stderr, "%*s", 7 + token->column, "");
+  fprintf(out, "%*s", 7 + token->column, "");
   //                     ^^^^^^^^^^^^^^^^^-- distance - amount of spaces.
 
   // Since we added enough spaces, we can now just print the ^-- Here. message.
-  fprintf(stderr, "^-- Here.\n");
-
-  free(line);
-
-  parser.hadError = true;
+  fprintf(out, "^-- Here.\n");
 }
 
 static void error(char *message) {
-  errorAt(&parser.previous, message);
+  Token token = previousToken();
+  errorAt(&token, message);
 }
 
 static void errorAtCurrent(char *message) {
-  errorAt(&parser.current, message);
+  Token token = currentToken();
+  errorAt(&token, message);
 }
 
 static void advance() {
-  parser.previous = parser.current;
+  if (HAS_TOKEN_BUFFER()) {
+    // Nothing before the previous token is ever looked at again.
+    parser.previous = parser.current;
+    discardTokens(parser.tokens, parser.previous);
+  } else {
+    parser.previousToken = parser.currentToken;
+  }
 
   while (1) {
-    parser.current = scanToken();
-    if (parser.current.type != TOKEN_ERROR)
+    if (HAS_TOKEN_BUFFER()) {
+      parser.current++;
+      parser.type = getTokenType(parser.tokens, parser.current);
+    } else {
+      parser.currentToken = scanToken();
+      parser.type = parser.currentToken.type;
+    }
+
+    if (parser.type != TOKEN_ERROR)
       break;
 
     // else
-    errorAtCurrent(parser.current.start);
+    errorAtCurrent(currentToken().start);
   }
 }
 
 static void consume(TokenType type, char *errorMessage) {
-  if (parser.current.type == type) {
+  if (currentType() == type) {
     advance();
     return;
   }
 
   // Not doing
-  // return parser.current.type == type;
+  // return currentType() == type;
   // because we want to advance if that condition is true.
   errorAtCurrent(errorMessage);
 }
 
+// Keeps track of how deep the stack gets. Every instruction goes
+// through here, and the optimizer calls it with a negative [effect]
+// when it takes instructions back out.
+static void trackStack(int effect) {
+  stackDepth += effect;
+
+  if (stackDepth > currentChunk()->maxStack)
+    currentChunk()->maxStack = stackDepth;
+}
+
 static void emitByte(uint8_t byte, int col) {
-  // We could've used parser.previous.column instead of requiring
+  // We could've used previousColumn() instead of requiring
   // a 'col' parameter, but take a look at this expression:
   //
   // print 1 + 1;
@@ -165,13 +233,15 @@ static void emitByte(uint8_t byte, int col) {
   // OP_PRINT
   // Since we emit ADD after the operands, it *might* be on
   // the wrong col.
-  writeChunk(currentChunk(), byte, parser.previous.line, col);
+  writeChunk(currentChunk(), byte, previousLine(), col);
+  trackStack(stackEffect(byte));
 }
 
 static void emitBytes(uint8_t byte1, uint8_t byte2, int col) {
-  // For OPCODES with operands.
+  // For OPCODES with operands. The operand isn't an instruction,
+  // so it doesn't touch the stack.
   emitByte(byte1, col);
-  emitByte(byte2, col);
+  writeChunk(currentChunk(), byte2, previousLine(), col);
 }
 
 static void emitReturn(int col) {
@@ -179,7 +249,219 @@ static void emitReturn(int col) {
 }
 
 static void emitConstant(Value value, int col) {
-  writeConstant(currentChunk(), value, parser.previous.line, col);
+  writeConstant(currentChunk(), value, previousLine(), col);
+  trackStack(1);
+}
+
+// The optimizer.
+//
+// The compiler is single-pass, so instead of walking a tree we look
+// back at the bytecode an operand just produced. Every parsing
+// function below remembers where its operands start in the chunk,
+// and if an operand turned out to be a single constant, the operator
+// is evaluated right here instead of at runtime:
+//
+// 1 + 2 * 3
+//
+// OP_CONSTANT 1        OP_CONSTANT 1
+// OP_CONSTANT 2   ->   OP_CONSTANT 6   ->   OP_CONSTANT 7
+// OP_CONSTANT 3        OP_ADD
+// OP_MULTIPLY
+// OP_ADD
+//
+// We only fold what can't fail. Something like "1 / true" is left
+// alone, so the runtime error still points at the right column.
+
+// Index of the constant loaded by the instruction at [offset], or -1.
+static int constantIndex(int offset) {
+  uint8_t *code = currentChunk()->code;
+
+  switch (code[offset]) {
+    case OP_CONSTANT:
+      return code[offset + 1];
+
+    case OP_CONSTANT_LONG:
+      return code[offset + 1] | (code[offset + 2] << 8) | 
+             (code[offset + 3] << 16);
+
+    default:
+      return -1;
+  }
+}
+
+// Checks if [start, end) holds exactly one instruction that loads
+// a constant value, and retrieves that value.
+static bool constantIn(int start, int end, Value *value) {
+  Chunk *chunk = currentChunk();
+  if (start >= end)
+    return false;
+
+  int length;
+  switch (chunk->code[start]) {
+    case OP_CONSTANT:
+      length = 2;
+      *value = chunk->constants.values[constantIndex(start)];
+      break;
+
+    case OP_CONSTANT_LONG:
+      length = 4;
+      *value = chunk->constants.values[constantIndex(start)];
+      break;
+
+    case OP_NIL:   length = 1; *value = NIL_VAL;         break;
+    case OP_TRUE:  length = 1; *value = BOOL_VAL(true);  break;
+    case OP_FALSE: length = 1; *value = BOOL_VAL(false); break;
+
+    default:
+      return false;
+  }
+
+  return end - start == length;
+}
+
+// Removes the constant instruction at [offset] and everything after
+// it. Its constant is dropped too, if no other instruction loads it
+// and nothing was added to the pool after it.
+static void discardConstant(int offset) {
+  // OP_NIL, OP_TRUE and OP_FALSE don't have one.
+  int index = constantIndex(offset);
+  if (index >= 0)
+    releaseConstant(currentChunk(), index);
+
+  truncateChunk(currentChunk(), offset);
+  trackStack(-1);
+}
+
+// Emits a folded value, using the dedicated instructions where
+// there are some.
+static void emitFolded(Value value, int col) {
+  if (IS_NIL(value)) {
+    emitByte(OP_NIL, col);
+  } else if (IS_BOOL(value)) {
+    emitByte(AS_BOOL(value) ? OP_TRUE : OP_FALSE, col);
+  } else {
+    emitConstant(value, col);
+  }
+}
+
+// Emits an operator that couldn't be folded. If its right operand
+// is a number constant, the load and the operator are fused into
+// one superinstruction:
+//
+// OP_CONSTANT 0 '2'
+// OP_MULTIPLY        ->  OP_MULTIPLY_CONSTANT 0 '2'
+static void emitOperator(OpCode op, int right, int col) {
+  Chunk *chunk = currentChunk();
+  Value b;
+
+  OpCode fused;
+  switch (op) {
+    case OP_ADD:      fused = OP_ADD_CONSTANT;      break;
+    case OP_SUBTRACT: fused = OP_SUBTRACT_CONSTANT; break;
+    case OP_MULTIPLY: fused = OP_MULTIPLY_CONSTANT; break;
+    case OP_DIVIDE:   fused = OP_DIVIDE_CONSTANT;   break;
+    default:
+      emitByte(op, col);
+      return;
+  }
+
+  // Only the single-byte form. An OP_WIDE fused instruction would
+  // be the same size as OP_CONSTANT_LONG + the operator, and
+  // bench/constants.c shows it running slower.
+  if (!constantIn(right, chunk->count, &b) || 
+      chunk->code[right] != OP_CONSTANT || !IS_NUMBER(b)) {
+
+    emitByte(op, col);
+    return;
+  }
+
+  uint8_t index = chunk->code[right + 1];
+  truncateChunk(chunk, right);
+  trackStack(-1);
+  emitBytes(fused, index, col);
+}
+
+// Emits a binary operator whose left operand starts at [left]
+// and whose right operand starts at [right].
+static void emitBinary(OpCode op, int left, int right, int col) {
+  Value a;
+  Value b;
+
+  if (!constantIn(left, right, &a) || 
+      !constantIn(right, currentChunk()->count, &b)) {
+
+    emitOperator(op, right, col);
+    return;
+  }
+
+  // == works on anything, and can't fail.
+  if (op == OP_EQUAL) {
+    discardConstant(right);
+    discardConstant(left);
+    emitFolded(BOOL_VAL(valuesEqual(a, b)), col);
+    return;
+  }
+
+  if (!IS_NUMBER(a) || !IS_NUMBER(b)) {
+
+    emitOperator(op, right, col);
+    return;
+  }
+
+  double result;
+  switch (op) {
+    case OP_ADD:      result = AS_NUMBER(a) + AS_NUMBER(b); break;
+    case OP_SUBTRACT: result = AS_NUMBER(a) - AS_NUMBER(b); break;
+    case OP_MULTIPLY: result = AS_NUMBER(a) * AS_NUMBER(b); break;
+    case OP_DIVIDE:   result = AS_NUMBER(a) / AS_NUMBER(b); break;
+    default:
+      emitByte(op, col);
+      return;
+  }
+
+  // Right first, so its constant is the last one in the pool.
+  discardConstant(right);
+  discardConstant(left);
+  emitFolded(NUMBER_VAL(result), col);
+}
+
+static void emitNegate(int operand, int col) {
+  Value value;
+
+  if (!constantIn(operand, currentChunk()->count, &value) ||
+      !IS_NUMBER(value)) {
+
+    emitByte(OP_NEGATE, col);
+    return;
+  }
+
+  discardConstant(operand);
+  emitFolded(NUMBER_VAL(-AS_NUMBER(value)), col);
+}
+
+static void emitNot(int operand, int col) {
+  Chunk *chunk = currentChunk();
+  Value value;
+
+  if (constantIn(operand, chunk->count, &value)) {
+    // Any constant can be negated - "!nil" is just true.
+    discardConstant(operand);
+    emitFolded(BOOL_VAL(isFalsey(value)), col);
+    return;
+  }
+
+  // "!!x" turns x into a boolean, so that pair has to stay, but any
+  // OP_NOT after that works on a boolean already: "!!!x" is "!x".
+  if (notRunEnd == chunk->count && notRunLength >= 2) {
+    truncateChunk(chunk, chunk->count - 1);
+    notRunLength--;
+    notRunEnd = chunk->count;
+    return;
+  }
+
+  notRunLength = notRunEnd == chunk->count ? notRunLength + 1 : 1;
+  emitByte(OP_NOT, col);
+  notRunEnd = chunk->count;
 }
 
 static void endCompiler(int col) {
@@ -191,13 +473,24 @@ static void endCompiler(int col) {
 }
 
 static void number() {
-  double value = strtod(parser.previous.start, NULL);
-  emitConstant(NUMBER_VAL(value), parser.previous.column);
+  Token token = previousToken();
+  double value = strtod(token.start, NULL);
+  emitConstant(NUMBER_VAL(value), token.column);
+}
+
+static void string() {
+  // The lexeme still has its quotes.
+  Token token = previousToken();
+  ObjString *string = copyString(token.start + 1, token.length - 2);
+
+  emitConstant(OBJ_VAL(string), token.column);
 }
 
 // Recursive descent parsing.
 // Let's forward declare everything since they're
 // recursive:
+static void equality();
+
 static void expression();
 
 static void term();
@@ -212,48 +505,84 @@ static void grouping();
 static void unary();
 
 // Let's get down to business:
+static void equality() {
+  int left = currentChunk()->count;
+  expression();
+
+  while (currentType() == TOKEN_EQUAL_EQUAL || 
+         currentType() == TOKEN_BANG_EQUAL) {
+
+    TokenType operator = currentType();
+    int column = currentColumn();
+    advance();
+
+    int right = currentChunk()->count;
+    expression();
+    emitBinary(OP_EQUAL, left, right, column);
+
+    // "a != b" is "!(a == b)".
+    if (operator == TOKEN_BANG_EQUAL)
+      emitNot(left, column);
+  }
+}
+
 static void expression() {
+  // Where the left operand starts - for the optimizer.
+  int left = currentChunk()->count;
   term();
 
-  while (parser.current.type == TOKEN_PLUS || parser.current.type == TOKEN_MINUS) {
-    Token operator = parser.current;
+  while (currentType() == TOKEN_PLUS || currentType() == TOKEN_MINUS) {
+    TokenType operator = currentType();
+    int column = currentColumn();
     advance();
+
+    int right = currentChunk()->count;
     term();
-    emitByte(operator.type == TOKEN_PLUS ? OP_ADD : OP_SUBTRACT, operator.column);
+    emitBinary(operator == TOKEN_PLUS ? OP_ADD : OP_SUBTRACT, left, right, 
+               column);
   }
 }
 
 static void term() {
+  int left = currentChunk()->count;
   factor();
 
-  while (parser.current.type == TOKEN_STAR || parser.current.type == TOKEN_SLASH) {
-    Token operator = parser.current;
+  while (currentType() == TOKEN_STAR || currentType() == TOKEN_SLASH) {
+    TokenType operator = currentType();
+    int column = currentColumn();
     advance();
+
+    int right = currentChunk()->count;
     factor();
-    emitByte(operator.type == TOKEN_STAR ? OP_MULTIPLY : OP_DIVIDE, operator.column);
+    emitBinary(operator == TOKEN_STAR ? OP_MULTIPLY : OP_DIVIDE, left, right,
+               column);
   }
 }
 
 static void factor() {
-  // Keeping track of the column
-  int col = parser.current.column;
-  Token token = parser.current;
+  TokenType type = currentType();
 
   // This if statement will be moved to another function later.
   // (its name will be literal())
-  if (token.type == TOKEN_NUMBER) {
+  if (type == TOKEN_NUMBER) {
     advance();
     number();
     return;
   }
 
-  if (token.type == TOKEN_LEFT_PAREN) {
+  if (type == TOKEN_STRING) {
+    advance();
+    string();
+    return;
+  }
+
+  if (type == TOKEN_LEFT_PAREN) {
     advance();
     grouping();
     return;
   }
   
-  if (token.type == TOKEN_BANG || token.type == TOKEN_MINUS || token.type == TOKEN_PLUS) {
+  if (type == TOKEN_BANG || type == TOKEN_MINUS || type == TOKEN_PLUS) {
     advance();
     unary();
     return;
@@ -264,22 +593,26 @@ static void factor() {
 }
 
 static void literal() {
-  switch (parser.current.type) {
+  switch (currentType()) {
     case TOKEN_TRUE:
-      emitByte(OP_TRUE, parser.current.column);
+      emitByte(OP_TRUE, currentColumn());
       advance();
       break;
 
     case TOKEN_FALSE:
-      emitByte(OP_FALSE, parser.current.column);
+      emitByte(OP_FALSE, currentColumn());
       advance();
       break;
 
     case TOKEN_NIL:
-      emitByte(OP_NIL, parser.current.column);
+      emitByte(OP_NIL, currentColumn());
       advance();
       break;
 
+    case TOKEN_STRING_INTERPOLATION:
+      errorAtCurrent("String interpolation isn't supported yet.");
+      return;
+
     default:
       // TODO: move numbers to this function.
       // None of the cases match - must be a syntax error.
@@ -291,36 +624,74 @@ static void literal() {
 }
 
 static void grouping() {
-  expression();
+  equality();
   consume(TOKEN_RIGHT_PAREN, "Expected ')' after expression.");
 }
 
 static void unary() {
-  Token operator = parser.previous;
+  Token operator = previousToken();
+  int operand = currentChunk()->count;
 
   // Compile the operand first.
   factor();
 
   switch (operator.type) {
-    case TOKEN_MINUS: emitByte(OP_NEGATE, operator.column);
+    case TOKEN_MINUS: emitNegate(operand, operator.column); break;
+    case TOKEN_BANG:  emitNot(operand, operator.column);    break;
     default: return;
   }
 }
 
-bool compile(char *source, Chunk *chunk) {
-  // We won't build the compiler - yet.
-  initScanner(source);
+// Compiles whatever the scanner was set up with.
+static bool compileTokens(char *source, TokenBuffer *tokens, Chunk *chunk) {
   compilingChunk = chunk;
+  notRunLength = 0;
+  notRunEnd = -1;
+  stackDepth = 0;
 
   parser.source = source;
+  parser.tokens = tokens;
+
+  // advance() moves these onto token 0.
+  parser.current = -1;
+  parser.previous = -1;
   parser.hadError = false;
   parser.panicMode = false;
 
+  // The scanner has just started a line index for [source]. Runtime
+  // errors can use it too, as long as nothing starts it over first.
+  chunk->lineIndexStamp = getLineIndexStamp();
+
   advance();
-  expression();
+  equality();
   consume(TOKEN_EOF, "Expected end of expression.");
-  endCompiler(parser.previous.column);
+  endCompiler(previousColumn());
 
   // compile() should return false if an error occured.
   return !parser.hadError;
+}
+
+bool compile(char *source, Chunk *chunk) {
+#ifdef BATCHED_TOKENS
+  TokenBuffer tokens;
+  initTokenBuffer(&tokens, source);
+
+  bool result = compileTokens(source, &tokens, chunk);
+
+  freeTokenBuffer(&tokens);
+  return result;
+#else
+  initScanner(source);
+  return compileTokens(source, NULL, chunk);
+#endif
+}
+
+bool compileStream(int fd, Chunk *chunk) {
+  initScannerStream(fd);
+
+  // There's no source to show offending lines from.
+  bool result = compileTokens(NULL, NULL, chunk);
+
+  freeScanner();
+  return result;
 }
\ No newline at end of file
@@ -1,12 +1,21 @@
 #ifndef CLOXIM_COMPILER_H
 #define CLOXIM_COMPILER_H
 
-#include "vm.h"
+#include <stdio.h>
 
-// Useful for runtimeError() in VM.
-char *getOffendingLine(int);
+#include "vm.h"
 
 // Compiles a stream of characters.
 bool compile(char *, Chunk *);
 
+// Compiles everything read from a file descriptor, without ever
+// holding all of it in memory.
+bool compileStream(int, Chunk *);
+
+// Sends compile errors from the calling thread to [output] instead
+// of stderr. NULL goes back to stderr. Both compile functions can
+// run on several threads at once, so this keeps each one's errors
+// apart.
+void setErrorOutput(FILE *);
+
 #endif
\ No newline at end of file
@@ -15,6 +15,30 @@ void disassembleChunk(Chunk *chunk, char *name) {
   // Nothing.
 }
 
+char *opcodeName(uint8_t instruction) {
+  switch (instruction) {
+    case OP_CONSTANT:          return "OP_CONSTANT";
+    case OP_CONSTANT_LONG:     return "OP_CONSTANT_LONG";
+    case OP_NIL:               return "OP_NIL";
+    case OP_TRUE:              return "OP_TRUE";
+    case OP_FALSE:             return "OP_FALSE";
+    case OP_ADD:               return "OP_ADD";
+    case OP_SUBTRACT:          return "OP_SUBTRACT";
+    case OP_MULTIPLY:          return "OP_MULTIPLY";
+    case OP_DIVIDE:            return "OP_DIVIDE";
+    case OP_NOT:               return "OP_NOT";
+    case OP_NEGATE:            return "OP_NEGATE";
+    case OP_EQUAL:             return "OP_EQUAL";
+    case OP_RETURN:            return "OP_RETURN";
+    case OP_ADD_CONSTANT:      return "OP_ADD_CONSTANT";
+    case OP_SUBTRACT_CONSTANT: return "OP_SUBTRACT_CONSTANT";
+    case OP_MULTIPLY_CONSTANT: return "OP_MULTIPLY_CONSTANT";
+    case OP_DIVIDE_CONSTANT:   return "OP_DIVIDE_CONSTANT";
+    case OP_WIDE:              return "OP_WIDE";
+    default:                   return "OP_UNKNOWN";
+  }
+}
+
 // disassembleInstruction() helper for simple instructions.
 static int simpleInstruction(char *name, int offset) {
   // Just print its name and advance.
@@ -55,11 +79,34 @@ static int longConstantInstruction(const char* name, Chunk* chunk,
   return offset + 4;
 }
 
+// An instruction behind an OP_WIDE prefix: the same instruction,
+// with a 3-byte operand.
+static int wideInstruction(Chunk *chunk, int offset) {
+  uint8_t instruction = chunk->code[offset + 1];
+  char *name;
+
+  switch (instruction) {
+    case OP_CONSTANT:          name = "OP_WIDE OP_CONSTANT";          break;
+    case OP_ADD_CONSTANT:      name = "OP_WIDE OP_ADD_CONSTANT";      break;
+    case OP_SUBTRACT_CONSTANT: name = "OP_WIDE OP_SUBTRACT_CONSTANT"; break;
+    case OP_MULTIPLY_CONSTANT: name = "OP_WIDE OP_MULTIPLY_CONSTANT"; break;
+    case OP_DIVIDE_CONSTANT:   name = "OP_WIDE OP_DIVIDE_CONSTANT";   break;
+
+    default:
+      printf("Unknown wide OPCODE %d\n", instruction);
+      return offset + 2;
+  }
+
+  // Past the prefix, it's laid out just like OP_CONSTANT_LONG.
+  return longConstantInstruction(name, chunk, offset + 1);
+}
+
 // Disassemble an individual instruction.
 int disassembleInstruction(Chunk *chunk, int offset) {
   // The instruction index
   printf("%04d ", offset);
-  int line = getLine(chunk, offset);  
+  Position position = getPosition(chunk, offset);
+  int line = position.line;
 
   if (offset > 0 && line == getLine(chunk, offset - 1)) {
     // If the current line is the same as the previous one
@@ -76,7 +123,7 @@ int disassembleInstruction(Chunk *chunk, int offset) {
   //      ^-- same line 
 
   // Print the column
-  printf(" %2d ", chunk->columns[offset]);
+  printf(" %2d ", position.column);
 
   uint8_t instruction = chunk->code[offset];
   // Check its type - if it's an OP_RETURN, return this,
@@ -115,9 +162,30 @@ int disassembleInstruction(Chunk *chunk, int offset) {
     case OP_DIVIDE:
       return simpleInstruction("OP_DIVIDE", offset);
 
+    case OP_NOT:
+      return simpleInstruction("OP_NOT", offset);
+
     case OP_NEGATE:
       return simpleInstruction("OP_NEGATE", offset);
+
+    case OP_EQUAL:
+      return simpleInstruction("OP_EQUAL", offset);
     
+    case OP_ADD_CONSTANT:
+      return constantInstruction("OP_ADD_CONSTANT", chunk, offset);
+
+    case OP_SUBTRACT_CONSTANT:
+      return constantInstruction("OP_SUBTRACT_CONSTANT", chunk, offset);
+
+    case OP_MULTIPLY_CONSTANT:
+      return constantInstruction("OP_MULTIPLY_CONSTANT", chunk, offset);
+
+    case OP_DIVIDE_CONSTANT:
+      return constantInstruction("OP_DIVIDE_CONSTANT", chunk, offset);
+
+    case OP_WIDE:
+      return wideInstruction(chunk, offset);
+
     default:
       printf("Unknown OPCODE %d\n", instruction);
       // Advance one instruction forward.
@@ -11,4 +11,7 @@ void disassembleChunk(Chunk *, char *);
 // Disassembles a single instruction.
 int disassembleInstruction(Chunk *, int);
 
+// An opcode's name, like "OP_ADD".
+char *opcodeName(uint8_t);
+
 #endif
\ No newline at end of file
@@ -2,11 +2,23 @@
 #include <stdlib.h>
 #include <string.h>
 
+#ifndef _WIN32
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
 // My own implementation of Lox.
 
 #include "common.h"
+#include "cache.h"
 #include "chunk.h"
+#include "compiler.h"
 #include "debug.h"
+#include "memory.h"
+#include "object.h"
+#include "profiler.h"
+#include "source.h"
+#include "trace.h"
 #include "vm.h"
 
 static void repl() {
@@ -30,55 +42,84 @@ static void repl() {
   }
 }
 
-static char *readFile(char *path) {
-  // Open the file
-  FILE *file = fopen(path, "rb");
+// What --trace records, and where it's written after a runtime
+// error.
+static Trace trace;
+static char *tracePath = NULL;
 
-  if (file == NULL) {
-    fprintf(stderr, "Could not open \"%s\". Make sure you're in the correct"
-            " directory.\n", path);
-    
-    // No need to close it - it is already NULL.
-    exit(74);
+static void dumpTrace(Chunk *chunk) {
+  if (tracePath == NULL)
+    return;
+
+  if (writeTrace(&trace, chunk, tracePath)) {
+    fprintf(stderr, "Execution trace written to \"%s\".\n", tracePath);
+  } else {
+    fprintf(stderr, "Could not write an execution trace to \"%s\".\n", 
+            tracePath);
   }
+}
 
-  // Calculate its size.
-  fseek(file, 0L, SEEK_END);
-  size_t fileSize = ftell(file);
-  rewind(file);
+// Compiles and runs a script piped into stdin, block by block.
+static void runStream() {
+  Arena arena;
+  initArena(&arena);
 
-  // Read the file
-  char *buf = malloc(fileSize + 1); // +1 for \0
+  Chunk chunk;
+  initChunk(&chunk);
+  setChunkArena(&chunk, &arena);
 
-  if (buf == NULL) {
-    fprintf(stderr, "Not enough memory to read \"%s\". "
-                    "(File size %zu bytes + 1)\n", path, fileSize);
-    
-    exit(74);
-  }
+  InterpretResult result = INTERPRET_COMPILE_ERROR;
+  if (compileStream(0, &chunk))
+    result = interpretChunk(&chunk, NULL);
 
-  size_t bytesRead = fread(buf, sizeof (char), fileSize, file);
-  
-  if (bytesRead < fileSize) {
-    fprintf(stderr, "Failed to read \"%s\". This issue is unlikely.\n", path);
-    exit(74);
-  }
+  if (result == INTERPRET_RUNTIME_ERROR)
+    dumpTrace(&chunk);
 
-  buf[bytesRead] = '\0';
+  freeChunk(&chunk);
+  freeArena(&arena);
+
+  if (result == INTERPRET_COMPILE_ERROR)
+    exit(65);
 
-  // Return it.
-  fclose(file);
-  return buf;
+  if (result == INTERPRET_RUNTIME_ERROR)
+    exit(70);
 }
 
 static void runFile(char *path) {
   // Read the contents of the file.
-  char *source = readFile(path);
+  Source file = readFile(path);
+  char *source = file.text;
+
+  // Skip scanning and compiling if the script hasn't changed
+  // since we last cached it.
+  char *cache = cachePath(path);
+  uint64_t hash = hashSource(source, file.length);
+
+  // Everything the chunk holds dies with it.
+  Arena arena;
+  initArena(&arena);
+
+  Chunk chunk;
+  initChunk(&chunk);
+  setChunkArena(&chunk, &arena);
+
+  InterpretResult result;
+  if (loadCache(cache, hash, &chunk)) {
+    result = interpretChunk(&chunk, source);
+  } else if (compile(source, &chunk)) {
+    writeCache(cache, hash, &chunk);
+    result = interpretChunk(&chunk, source);
+  } else {
+    result = INTERPRET_COMPILE_ERROR;
+  }
 
-  // Interpret the source code.
-  InterpretResult result = interpret(source);
+  if (result == INTERPRET_RUNTIME_ERROR)
+    dumpTrace(&chunk);
 
-  free(source);
+  freeChunk(&chunk);
+  freeArena(&arena);
+  free(cache);
+  freeSource(&file);
 
   if (result == INTERPRET_COMPILE_ERROR)
     exit(65);
@@ -87,19 +128,277 @@ static void runFile(char *path) {
     exit(70);
 }
 
+// One script in a batch compile.
+typedef struct {
+  char *path;
+  bool compiled;
+
+  // Its errors, kept aside so they can be printed under the
+  // script's name instead of mixed in with everyone else's. They're
+  // held in memory, so a batch of thousands of scripts doesn't keep
+  // a file open for each one. NULL if nothing was written - or if
+  // no buffer could be made, in which case they went straight to
+  // stderr.
+  char *errors;
+  size_t errorsLength;
+} CompileJob;
+
+// Opens a stream that collects a job's errors in memory.
+static FILE *openErrors(CompileJob *job) {
+#ifndef _WIN32
+  return open_memstream(&job->errors, &job->errorsLength);
+#else
+  // No open_memstream() here, so go through a temporary file. It's
+  // read back and closed as soon as the job is done.
+  (void) job;
+  return tmpfile();
+#endif
+}
+
+// Closes the stream from openErrors(), leaving what was written in
+// job->errors.
+static void closeErrors(CompileJob *job, FILE *errors) {
+#ifndef _WIN32
+  fclose(errors);
+
+  // The buffer is there even if nothing was written to it.
+  if (job->errorsLength == 0) {
+    free(job->errors);
+    job->errors = NULL;
+  }
+#else
+  long length = ftell(errors);
+  char *buffer = length > 0 ? malloc((size_t) length) : NULL;
+
+  if (buffer != NULL) {
+    rewind(errors);
+    job->errorsLength = fread(buffer, 1, (size_t) length, errors);
+    job->errors = buffer;
+  }
+
+  fclose(errors);
+#endif
+}
+
+static void compileJob(CompileJob *job) {
+  FILE *errors = openErrors(job);
+
+  // A script that can't be read fails on its own, like one that
+  // doesn't compile, and the rest of the batch carries on.
+  Source file;
+  if (!loadSource(job->path, &file, errors != NULL ? errors : stderr)) {
+    job->compiled = false;
+
+    if (errors != NULL)
+      closeErrors(job, errors);
+
+    return;
+  }
+
+  char *cache = cachePath(job->path);
+  uint64_t hash = hashSource(file.text, file.length);
+
+  Arena arena;
+  initArena(&arena);
+
+  Chunk chunk;
+  initChunk(&chunk);
+  setChunkArena(&chunk, &arena);
+
+  setErrorOutput(errors);
+
+  // Scripts with an up to date cache have compiled before.
+  job->compiled = loadCache(cache, hash, &chunk);
+
+  if (!job->compiled) {
+    job->compiled = compile(file.text, &chunk);
+
+    if (job->compiled)
+      writeCache(cache, hash, &chunk);
+  }
+
+  setErrorOutput(NULL);
+
+  if (errors != NULL)
+    closeErrors(job, errors);
+
+  freeChunk(&chunk);
+  freeArena(&arena);
+  free(cache);
+  freeSource(&file);
+}
+
+// Most threads a batch compile will start.
+#define MAX_WORKERS 64
+
+#ifndef _WIN32
+// The jobs still to be handed out. Workers take the next one as
+// soon as they're done with their last, so a few big scripts don't
+// hold everyone else up.
+typedef struct {
+  CompileJob *jobs;
+  int count;
+  int next;
+  pthread_mutex_t lock;
+} JobQueue;
+
+static void *compileWorker(void *arg) {
+  JobQueue *queue = arg;
+
+  while (1) {
+    pthread_mutex_lock(&queue->lock);
+    int index = queue->next++;
+    pthread_mutex_unlock(&queue->lock);
+
+    if (index >= queue->count)
+      return NULL;
+
+    compileJob(&queue->jobs[index]);
+  }
+}
+
+static void compileJobs(CompileJob *jobs, int count) {
+  JobQueue queue = {.jobs = jobs, .count = count};
+  pthread_mutex_init(&queue.lock, NULL);
+
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  int workers = cores < 1 ? 1 : (int) cores;
+
+  if (workers > count)
+    workers = count;
+
+  if (workers > MAX_WORKERS)
+    workers = MAX_WORKERS;
+
+  // This thread is one of the workers too.
+  pthread_t threads[MAX_WORKERS];
+  int started = 0;
+
+  while (started < workers - 1 && 
+         pthread_create(&threads[started], NULL, compileWorker, &queue) == 0)
+    started++;
+
+  compileWorker(&queue);
+
+  for (int i = 0; i < started; i++)
+    pthread_join(threads[i], NULL);
+
+  pthread_mutex_destroy(&queue.lock);
+}
+#else
+static void compileJobs(CompileJob *jobs, int count) {
+  for (int i = 0; i < count; i++)
+    compileJob(&jobs[i]);
+}
+#endif
+
+// Compiles every script in [paths] without running any of them,
+// spread over as many threads as there are cores. Scripts that
+// compile get their cache written, so running them later skips 
+// straight to the VM.
+static void checkFiles(char **paths, int count) {
+  CompileJob *jobs = malloc(sizeof (CompileJob) * count);
+
+  if (jobs == NULL) {
+    fprintf(stderr, "Not enough memory to compile %d scripts.\n", count);
+    exit(74);
+  }
+
+  for (int i = 0; i < count; i++)
+    jobs[i] = (CompileJob) {.path = paths[i]};
+
+  compileJobs(jobs, count);
+
+  // Report in the order the scripts were given, whichever order
+  // they finished in.
+  int failed = 0;
+
+  for (int i = 0; i < count; i++) {
+    CompileJob *job = &jobs[i];
+
+    if (!job->compiled) {
+      failed++;
+      fprintf(stderr, "In \"%s\":\n", job->path);
+    }
+
+    if (!job->compiled && job->errors != NULL)
+      fwrite(job->errors, 1, job->errorsLength, stderr);
+
+    free(job->errors);
+  }
+
+  free(jobs);
+
+  if (failed > 0) {
+    fprintf(stderr, "%d of %d scripts failed to compile.\n", failed, count);
+    exit(65);
+  }
+}
+
+static void reportMemStats() {
+  // Let the script's own output come first.
+  fflush(stdout);
+  printMemStats(stderr);
+}
+
+// What --profile collects.
+static Profile profile;
+static bool isProfiling = false;
+
+static void reportProfile() {
+  fflush(stdout);
+  printProfile(&profile, stderr);
+}
+
 int main(int argc, char **argv) {
+  // --mem-stats, --profile and --trace go in front of everything
+  // else. The first two report what the run cost however it ends -
+  // even through exit(). --trace keeps a record of the last 
+  // instructions that ran, and writes it to [path] if one fails.
+  while (argc > 1) {
+    if (strcmp(argv[1], "--mem-stats") == 0) {
+      enableMemStats();
+      atexit(reportMemStats);
+    } else if (strcmp(argv[1], "--profile") == 0) {
+      initProfile(&profile);
+      isProfiling = true;
+      atexit(reportProfile);
+    } else if (strcmp(argv[1], "--trace") == 0 && argc > 2) {
+      tracePath = argv[2];
+      argc--;
+      argv++;
+    } else {
+      break;
+    }
+
+    argc--;
+    argv++;
+  }
+
   initVM();
 
+  if (isProfiling)
+    setProfile(&profile);
+
+  if (tracePath != NULL)
+    setTrace(&trace);
+
   if (argc == 1) {
     // Read input, Evaluate, Print, Loop
     repl();
-  } else if (argc == 2) {
+  } else if (argc == 2 && strcmp(argv[1], "-") == 0) {
+    runStream();
+  } else if (argc == 2 && strcmp(argv[1], "--check") != 0) {
     runFile(argv[1]);
+  } else if (argc > 2 && strcmp(argv[1], "--check") == 0) {
+    checkFiles(argv + 2, argc - 2);
   } else {
-    fprintf(stderr, "Usage: loxm [path]\n");
+    fprintf(stderr, "Usage: loxim [--mem-stats] [--profile] [--trace path] "
+                    "[path | - | --check path...]\n");
     exit(64);
   }
 
   freeVM();
+  freeObjects();
   return 0;
 }
\ No newline at end of file
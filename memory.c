@@ -1,8 +1,191 @@
+#include <stdatomic.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "memory.h"
 
-void *reallocate(void *ptr, size_t oldSize, size_t newSize) {
+// What one call site has cost.
+typedef struct {
+  // The "file.c:123" string from ALLOC_SITE, or NULL for a free
+  // slot. The strings are literals, so comparing pointers is enough.
+  _Atomic (const char *) site;
+
+  atomic_size_t calls;
+  atomic_size_t allocated;
+  atomic_size_t freed;
+
+  // How much of [allocated] was handed out by an arena, rather than
+  // straight from the heap.
+  atomic_size_t inArena;
+} SiteStats;
+
+// Open-addressing table of call sites. There are only a few dozen
+// GROW_ARRAY()s and FREE_ARRAY()s in the whole interpreter.
+#define MAX_SITES 256
+
+typedef struct {
+  bool isEnabled;
+
+  atomic_size_t calls;
+  atomic_size_t allocated;
+  atomic_size_t freed;
+  atomic_size_t peak;
+
+  SiteStats sites[MAX_SITES];
+} MemStats;
+
+static MemStats memStats;
+
+// The site arena blocks are counted against. What the arena hands
+// out from them is counted against whoever asked for it, so the
+// blocks get a line of their own instead of being charged to
+// whichever request happened to open one.
+static const char arenaBlockSite[] = "arena blocks";
+
+void enableMemStats() {
+  memStats.isEnabled = true;
+}
+
+// Finds the slot for [site], claiming a free one if it's new. NULL
+// if the table is full.
+static SiteStats *findSite(const char *site) {
+  size_t index = ((uintptr_t) site >> 3) & (MAX_SITES - 1);
+
+  for (int i = 0; i < MAX_SITES; i++) {
+    SiteStats *stats = &memStats.sites[index];
+    const char *current = atomic_load(&stats->site);
+
+    if (current == site)
+      return stats;
+
+    // Another thread might claim the slot first - for the same 
+    // site or a different one.
+    if (current == NULL) {
+      if (atomic_compare_exchange_strong(&stats->site, &current, site) ||
+          current == site) {
+
+        return stats;
+      }
+    }
+
+    index = (index + 1) & (MAX_SITES - 1);
+  }
+
+  return NULL;
+}
+
+// Counts a request against its call site only. Arena requests come
+// out of blocks the overall totals already have.
+static void countSite(size_t oldSize, size_t newSize, const char *site,
+                      bool isInArena) {
+
+  size_t allocated = newSize > oldSize ? newSize - oldSize : 0;
+  size_t freed = oldSize > newSize ? oldSize - newSize : 0;
+
+  SiteStats *stats = findSite(site);
+  if (stats == NULL)
+    return;
+
+  atomic_fetch_add(&stats->calls, 1);
+  atomic_fetch_add(&stats->allocated, allocated);
+  atomic_fetch_add(&stats->freed, freed);
+
+  if (isInArena)
+    atomic_fetch_add(&stats->inArena, allocated);
+}
+
+static void countAllocation(size_t oldSize, size_t newSize, 
+                            const char *site) {
+
+  size_t allocated = newSize > oldSize ? newSize - oldSize : 0;
+  size_t freed = oldSize > newSize ? oldSize - newSize : 0;
+
+  atomic_fetch_add(&memStats.calls, 1);
+  size_t total = atomic_fetch_add(&memStats.allocated, allocated) + 
+                 allocated;
+  atomic_fetch_add(&memStats.freed, freed);
+
+  // The peak is only ever raised. With several threads this can
+  // miss a peak by the size of one allocation, which is fine.
+  size_t inUse = total - atomic_load(&memStats.freed);
+  size_t peak = atomic_load(&memStats.peak);
+  while (inUse > peak && 
+         !atomic_compare_exchange_weak(&memStats.peak, &peak, inUse));
+
+  countSite(oldSize, newSize, site, false);
+}
+
+MemTotals getMemTotals() {
+  return (MemTotals) {
+    atomic_load(&memStats.calls),
+    atomic_load(&memStats.allocated),
+    atomic_load(&memStats.freed),
+    atomic_load(&memStats.peak)
+  };
+}
+
+static int compareSites(const void *a, const void *b) {
+  size_t left = atomic_load(&(*(SiteStats **) a)->allocated);
+  size_t right = atomic_load(&(*(SiteStats **) b)->allocated);
+
+  return left < right ? 1 : left > right ? -1 : 0;
+}
+
+void printMemStats(FILE *file) {
+  size_t allocated = atomic_load(&memStats.allocated);
+  size_t freed = atomic_load(&memStats.freed);
+
+  fprintf(file, "== memory ==\n");
+  fprintf(file, "%-24s %12zu\n", "calls", atomic_load(&memStats.calls));
+  fprintf(file, "%-24s %12zu bytes\n", "allocated", allocated);
+  fprintf(file, "%-24s %12zu bytes\n", "freed", freed);
+  fprintf(file, "%-24s %12zu bytes\n", "still in use", allocated - freed);
+  fprintf(file, "%-24s %12zu bytes\n", "peak", 
+          atomic_load(&memStats.peak));
+
+  // Biggest spenders first. The arena blocks aren't a call site -
+  // what's in them is already counted against the sites that asked
+  // for it - so they go underneath.
+  SiteStats *sites[MAX_SITES];
+  SiteStats *blocks = NULL;
+  int count = 0;
+
+  for (int i = 0; i < MAX_SITES; i++) {
+    const char *site = atomic_load(&memStats.sites[i].site);
+
+    if (site == arenaBlockSite) {
+      blocks = &memStats.sites[i];
+    } else if (site != NULL) {
+      sites[count++] = &memStats.sites[i];
+    }
+  }
+
+  qsort(sites, count, sizeof (SiteStats *), compareSites);
+
+  fprintf(file, "\n%-24s %12s %12s %12s %12s\n", "site", "calls", 
+          "allocated", "freed", "in arenas");
+
+  for (int i = 0; i < count; i++) {
+    fprintf(file, "%-24s %12zu %12zu %12zu %12zu\n", 
+            atomic_load(&sites[i]->site), atomic_load(&sites[i]->calls), 
+            atomic_load(&sites[i]->allocated), 
+            atomic_load(&sites[i]->freed),
+            atomic_load(&sites[i]->inArena));
+  }
+
+  if (blocks != NULL) {
+    fprintf(file, "\n%-24s %12zu %12zu %12zu\n", arenaBlockSite,
+            atomic_load(&blocks->calls), atomic_load(&blocks->allocated),
+            atomic_load(&blocks->freed));
+  }
+}
+
+void *reallocate(void *ptr, size_t oldSize, size_t newSize, 
+                 const char *site) {
+
+  if (memStats.isEnabled)
+    countAllocation(oldSize, newSize, site);
+
   if (newSize == 0) {
     // That means we have to free it.
     free(ptr);
@@ -18,4 +201,98 @@ void *reallocate(void *ptr, size_t oldSize, size_t newSize) {
   }
 
   return result;
-}
\ No newline at end of file
+}
+
+struct ArenaBlock {
+  ArenaBlock *next;
+  size_t size;
+  size_t used;
+
+  // max_align_t so that whatever is put here is aligned for it.
+  max_align_t data[];
+};
+
+// Rounds [size] up so the next allocation stays aligned.
+#define ARENA_ALIGN(size) \
+  (((size) + _Alignof (max_align_t) - 1) & ~(_Alignof (max_align_t) - 1))
+
+void initArena(Arena *arena) {
+  arena->blocks = NULL;
+  arena->nextSize = ARENA_BLOCK_SIZE;
+}
+
+static void *arenaAllocate(Arena *arena, size_t size) {
+  size = ARENA_ALIGN(size);
+  ArenaBlock *block = arena->blocks;
+
+  if (block == NULL || block->size - block->used < size) {
+    // Whatever is left of the old block is wasted, but arrays grow by
+    // doubling, so the blocks do too - and then it's never much.
+    size_t blockSize = arena->nextSize;
+    if (blockSize < size)
+      blockSize = size;
+
+    block = reallocate(NULL, 0, sizeof (ArenaBlock) + blockSize, 
+                       arenaBlockSite);
+    block->next = arena->blocks;
+    block->size = blockSize;
+    block->used = 0;
+
+    arena->blocks = block;
+    arena->nextSize = blockSize * 2;
+  }
+
+  void *result = (char *) block->data + block->used;
+  block->used += size;
+  return result;
+}
+
+void *arenaReallocate(Arena *arena, void *ptr, size_t oldSize, 
+                      size_t newSize, const char *site) {
+
+  if (arena == NULL)
+    return reallocate(ptr, oldSize, newSize, site);
+
+  // What the caller asked for, not what it cost - see arenaBlockSite.
+  if (memStats.isEnabled)
+    countSite(oldSize, newSize, site, true);
+
+  // Nothing is freed on its own.
+  if (newSize == 0)
+    return NULL;
+
+  // The last allocation in the block can just move the end of the
+  // block, as long as there's room.
+  ArenaBlock *block = arena->blocks;
+  if (ptr != NULL && block != NULL &&
+      (char *) ptr + ARENA_ALIGN(oldSize) == 
+      (char *) block->data + block->used) {
+
+    size_t start = (size_t) ((char *) ptr - (char *) block->data);
+
+    if (block->size - start >= ARENA_ALIGN(newSize)) {
+      block->used = start + ARENA_ALIGN(newSize);
+      return ptr;
+    }
+  }
+
+  void *result = arenaAllocate(arena, newSize);
+
+  if (ptr != NULL)
+    memcpy(result, ptr, oldSize < newSize ? oldSize : newSize);
+
+  return result;
+}
+
+void freeArena(Arena *arena) {
+  ArenaBlock *block = arena->blocks;
+
+  while (block != NULL) {
+    ArenaBlock *next = block->next;
+    reallocate(block, sizeof (ArenaBlock) + block->size, 0, 
+               arenaBlockSite);
+    block = next;
+  }
+
+  initArena(arena);
+}
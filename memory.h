@@ -1,6 +1,8 @@
 #ifndef CLOXIM_MEMORY_H
 #define CLOXIM_MEMORY_H
 
+#include <stdio.h>
+
 #include "common.h"
 
 // Macro to grow the capacity of any array.
@@ -8,19 +10,89 @@
   ((capacity) < 8 ? 8 : (capacity) * 2)
 // Set it to 8 if capacity == 0 because 0 * 2 == 0.
 
+// "file.c:123" - where an allocation was made from, so the memory
+// stats can tell call sites apart.
+#define STRINGIFY_(x) #x
+#define STRINGIFY(x) STRINGIFY_(x)
+#define ALLOC_SITE (__FILE__ ":" STRINGIFY(__LINE__))
+
 // Macro to grow any array.
 #define GROW_ARRAY(type, ptr, oldCount, newCount) \
   (type *) reallocate(ptr, sizeof (type) * oldCount, \
-  sizeof (type) * newCount)
+  sizeof (type) * newCount, ALLOC_SITE)
 
 // Macro to free any array
 #define FREE_ARRAY(type, ptr, oldCount) \
   /* Reallocate it to 0 */ \
-  reallocate(ptr, sizeof (type) * oldCount, 0)
+  reallocate(ptr, sizeof (type) * oldCount, 0, ALLOC_SITE)
 
 // Calls our own `reallocate()` function.
 // We will be using this function to free,
-// reallocate and allocate objects.
-void *reallocate(void *, size_t, size_t);
+// reallocate and allocate objects. The last
+// parameter is the call site, for the stats.
+void *reallocate(void *, size_t, size_t, const char *);
+
+// Memory stats. When enabled, reallocate() keeps running totals -
+// overall and for every call site - that printMemStats() reports.
+// The overall totals are what came from the heap, arena blocks and
+// all. Call sites are charged for what they asked for, whether the
+// heap or an arena handed it out, and the blocks are reported on
+// their own.
+// They're safe to keep from several threads at once. Enable them 
+// before anything is allocated, or the early bytes are missed.
+void enableMemStats();
+
+void printMemStats(FILE *);
+
+// The overall totals so far, for measuring a stretch of code: take
+// them before and after, and subtract.
+typedef struct {
+  size_t calls;
+  size_t allocated;
+  size_t freed;
+
+  // The most that was ever in use at once.
+  size_t peak;
+} MemTotals;
+
+MemTotals getMemTotals();
+
+// A bump allocator, for things that all die at the same time - like
+// a chunk, which is thrown away as soon as it has run. Memory is
+// handed out from big blocks, one after the other, and only given
+// back all at once by freeArena().
+typedef struct ArenaBlock ArenaBlock;
+
+typedef struct {
+  // The block being handed out from. Older ones follow it.
+  ArenaBlock *blocks;
+
+  // How big the next block will be.
+  size_t nextSize;
+} Arena;
+
+// How big an arena's first block is.
+#define ARENA_BLOCK_SIZE (16 * 1024)
+
+void initArena(Arena *);
+
+// Like reallocate(), but out of [arena]. Freeing does nothing until
+// the whole arena goes. The last allocation can grow in place; 
+// anything else is copied. A NULL arena means the heap, through
+// reallocate(). Each request is counted against its call site, and
+// the blocks separately.
+void *arenaReallocate(Arena *, void *, size_t, size_t, const char *);
+
+// Frees everything allocated from the arena at once.
+void freeArena(Arena *);
+
+// GROW_ARRAY() and FREE_ARRAY(), for arrays that might live in an 
+// arena.
+#define GROW_ARRAY_IN(arena, type, ptr, oldCount, newCount) \
+  (type *) arenaReallocate(arena, ptr, sizeof (type) * (oldCount), \
+  sizeof (type) * (newCount), ALLOC_SITE)
+
+#define FREE_ARRAY_IN(arena, type, ptr, oldCount) \
+  arenaReallocate(arena, ptr, sizeof (type) * (oldCount), 0, ALLOC_SITE)
 
 #endif
\ No newline at end of file
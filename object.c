@@ -0,0 +1,206 @@
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+#include "memory.h"
+#include "object.h"
+
+// Every string there is, for interning. Open addressing with linear
+// probing, like a chunk's constant index. Strings are never taken
+// out, so there are no tombstones.
+typedef struct {
+  int count;
+
+  // A power of two.
+  int capacity;
+  ObjString **entries;
+} StringTable;
+
+static StringTable strings;
+
+// Several threads can compile at once, and they all intern into the
+// same table. Threads that find it taken sleep instead of spinning -
+// a rehash can hold it for a while.
+#ifdef _WIN32
+static SRWLOCK stringsLock = SRWLOCK_INIT;
+
+static void lockStrings() {
+  AcquireSRWLockExclusive(&stringsLock);
+}
+
+static void unlockStrings() {
+  ReleaseSRWLockExclusive(&stringsLock);
+}
+#else
+static pthread_mutex_t stringsLock = PTHREAD_MUTEX_INITIALIZER;
+
+static void lockStrings() {
+  pthread_mutex_lock(&stringsLock);
+}
+
+static void unlockStrings() {
+  pthread_mutex_unlock(&stringsLock);
+}
+#endif
+
+static uint32_t hashString(const char *chars, int length) {
+  // 32-bit FNV-1a.
+  uint32_t hash = 2166136261u;
+
+  for (int i = 0; i < length; i++) {
+    hash ^= (uint8_t) chars[i];
+    hash *= 16777619u;
+  }
+
+  return hash;
+}
+
+// Finds the string with these characters in [entries], or the empty
+// slot it would go in.
+static ObjString **findString(ObjString **entries, int capacity,
+                              const char *chars, int length,
+                              uint32_t hash) {
+
+  uint32_t index = hash & (capacity - 1);
+
+  while (1) {
+    ObjString **entry = &entries[index];
+
+    // The hash is compared first, so memcmp() only runs on strings
+    // that are almost certainly the same.
+    if (*entry == NULL ||
+        ((*entry)->hash == hash && (*entry)->length == length &&
+         memcmp((*entry)->chars, chars, length) == 0)) {
+
+      return entry;
+    }
+
+    index = (index + 1) & (capacity - 1);
+  }
+}
+
+static void growStrings() {
+  int capacity = GROW_CAPACITY(strings.capacity);
+  ObjString **entries = GROW_ARRAY(ObjString *, NULL, 0, capacity);
+
+  for (int i = 0; i < capacity; i++)
+    entries[i] = NULL;
+
+  for (int i = 0; i < strings.capacity; i++) {
+    ObjString *string = strings.entries[i];
+    if (string == NULL)
+      continue;
+
+    *findString(entries, capacity, string->chars, string->length,
+                string->hash) = string;
+  }
+
+  FREE_ARRAY(ObjString *, strings.entries, strings.capacity);
+
+  strings.entries = entries;
+  strings.capacity = capacity;
+}
+
+static ObjString *allocateString(const char *chars, int length,
+                                 uint32_t hash) {
+
+  ObjString *string = reallocate(NULL, 0, sizeof (ObjString) + length + 1,
+                                 ALLOC_SITE);
+
+  string->obj.type = OBJ_STRING;
+  string->length = length;
+  string->hash = hash;
+  memcpy(string->chars, chars, length);
+  string->chars[length] = '\0';
+
+  return string;
+}
+
+static void freeString(ObjString *string) {
+  reallocate(string, sizeof (ObjString) + string->length + 1, 0,
+             ALLOC_SITE);
+}
+
+// Looks for the string in the table. If it isn't there, [string] is
+// added, unless it's NULL. Must be called with the lock held.
+static ObjString *internString(const char *chars, int length,
+                               uint32_t hash, ObjString *string) {
+
+  if (strings.capacity > 0) {
+    ObjString **entry = findString(strings.entries, strings.capacity,
+                                   chars, length, hash);
+
+    if (*entry != NULL || string == NULL)
+      return *entry;
+  }
+
+  if (string == NULL)
+    return NULL;
+
+  // Keep the table at most 3/4 full.
+  if (strings.count + 1 > strings.capacity * 3 / 4)
+    growStrings();
+
+  *findString(strings.entries, strings.capacity, chars, length,
+              hash) = string;
+
+  strings.count++;
+  return string;
+}
+
+ObjString *copyString(const char *chars, int length) {
+  uint32_t hash = hashString(chars, length);
+
+  // Most literals have been seen before, so look first.
+  lockStrings();
+  ObjString *string = internString(chars, length, hash, NULL);
+  unlockStrings();
+
+  if (string != NULL)
+    return string;
+
+  // The new string is made without holding the lock. Another thread
+  // might add the same one meanwhile, in which case theirs wins.
+  ObjString *made = allocateString(chars, length, hash);
+
+  lockStrings();
+  string = internString(chars, length, hash, made);
+  unlockStrings();
+
+  if (string != made)
+    freeString(made);
+
+  return string;
+}
+
+void freeObjects() {
+  lockStrings();
+
+  for (int i = 0; i < strings.capacity; i++) {
+    ObjString *string = strings.entries[i];
+    if (string == NULL)
+      continue;
+
+    freeString(string);
+  }
+
+  FREE_ARRAY(ObjString *, strings.entries, strings.capacity);
+  strings.entries = NULL;
+  strings.capacity = 0;
+  strings.count = 0;
+
+  unlockStrings();
+}
+
+void printObject(Value value) {
+  switch (OBJ_TYPE(value)) {
+    case OBJ_STRING:
+      printf("%s", AS_CSTRING(value));
+      break;
+  }
+}
\ No newline at end of file
@@ -0,0 +1,54 @@
+#ifndef CLOXIM_OBJECT_H
+#define CLOXIM_OBJECT_H
+
+#include "common.h"
+#include "value.h"
+
+// Values too big to fit in a Value live on the heap as objects, and
+// the Value only points at them.
+
+#define OBJ_TYPE(value)   (AS_OBJ(value)->type)
+
+#define IS_STRING(value)  isObjType(value, OBJ_STRING)
+
+#define AS_STRING(value)  ((ObjString *) AS_OBJ(value))
+#define AS_CSTRING(value) (AS_STRING(value)->chars)
+
+typedef enum {
+  OBJ_STRING
+} ObjType;
+
+// What every object starts with.
+struct Obj {
+  ObjType type;
+};
+
+// Strings are interned: there's only ever one ObjString with any
+// given characters, so two strings are equal exactly when they're
+// the same object.
+struct ObjString {
+  Obj obj;
+  int length;
+
+  // Worked out once, when the string is made.
+  uint32_t hash;
+
+  // [length] characters and a \0.
+  char chars[];
+};
+
+// Retrieves the string with [length] characters from [chars],
+// making it if there isn't one yet. [chars] is copied. Any thread
+// can call it.
+ObjString *copyString(const char *chars, int length);
+
+// Frees every object there is. Nothing may use one afterwards.
+void freeObjects();
+
+void printObject(Value);
+
+static inline bool isObjType(Value value, ObjType type) {
+  return IS_OBJ(value) && AS_OBJ(value)->type == type;
+}
+
+#endif
\ No newline at end of file
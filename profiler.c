@@ -0,0 +1,186 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "debug.h"
+#include "memory.h"
+#include "profiler.h"
+
+// How many of the hottest lines the report shows.
+#define PROFILE_TOP_LINES 20
+
+void initProfile(Profile *profile) {
+  memset(profile->opCounts, 0, sizeof (profile->opCounts));
+  memset(profile->opCycles, 0, sizeof (profile->opCycles));
+
+  profile->lineCapacity = 0;
+  profile->lineCounts = NULL;
+  profile->lineCycles = NULL;
+
+  profile->offsetCapacity = 0;
+  profile->offsetCounts = NULL;
+  profile->offsetCycles = NULL;
+
+  profile->current = -1;
+  profile->started = 0;
+}
+
+void freeProfile(Profile *profile) {
+  FREE_ARRAY(uint64_t, profile->lineCounts, profile->lineCapacity);
+  FREE_ARRAY(uint64_t, profile->lineCycles, profile->lineCapacity);
+  FREE_ARRAY(uint64_t, profile->offsetCounts, profile->offsetCapacity);
+  FREE_ARRAY(uint64_t, profile->offsetCycles, profile->offsetCapacity);
+  initProfile(profile);
+}
+
+void startProfile(Profile *profile, Chunk *chunk) {
+  if (profile->offsetCapacity < chunk->count) {
+    int oldCapacity = profile->offsetCapacity;
+    profile->offsetCapacity = chunk->count;
+
+    profile->offsetCounts = GROW_ARRAY(uint64_t, profile->offsetCounts,
+                                       oldCapacity, profile->offsetCapacity);
+    profile->offsetCycles = GROW_ARRAY(uint64_t, profile->offsetCycles,
+                                       oldCapacity, profile->offsetCapacity);
+  }
+
+  memset(profile->offsetCounts, 0, sizeof (uint64_t) * chunk->count);
+  memset(profile->offsetCycles, 0, sizeof (uint64_t) * chunk->count);
+
+  profile->current = -1;
+}
+
+// Makes room for line [line], zeroing whatever's new.
+static void growLines(Profile *profile, int line) {
+  if (line < profile->lineCapacity)
+    return;
+
+  int oldCapacity = profile->lineCapacity;
+  int capacity = GROW_CAPACITY(oldCapacity);
+  while (capacity <= line)
+    capacity = GROW_CAPACITY(capacity);
+
+  profile->lineCounts = GROW_ARRAY(uint64_t, profile->lineCounts,
+                                   oldCapacity, capacity);
+  profile->lineCycles = GROW_ARRAY(uint64_t, profile->lineCycles,
+                                   oldCapacity, capacity);
+
+  memset(profile->lineCounts + oldCapacity, 0,
+         sizeof (uint64_t) * (capacity - oldCapacity));
+  memset(profile->lineCycles + oldCapacity, 0,
+         sizeof (uint64_t) * (capacity - oldCapacity));
+
+  profile->lineCapacity = capacity;
+}
+
+void endProfile(Profile *profile, Chunk *chunk) {
+  // The last instruction - an OP_RETURN, or whatever failed - is
+  // still running, as far as the profile knows.
+  if (profile->current >= 0) {
+    profile->offsetCycles[profile->current] +=
+      readCycles() - profile->started;
+  }
+
+  profile->current = -1;
+
+  for (int offset = 0; offset < chunk->count; offset++) {
+    uint64_t count = profile->offsetCounts[offset];
+    if (count == 0)
+      continue;
+
+    uint64_t cycles = profile->offsetCycles[offset];
+    uint8_t instruction = chunk->code[offset];
+
+    profile->opCounts[instruction] += count;
+    profile->opCycles[instruction] += cycles;
+
+    int line = getLine(chunk, offset);
+    growLines(profile, line);
+    profile->lineCounts[line] += count;
+    profile->lineCycles[line] += cycles;
+  }
+}
+
+// What compareCycles() sorts by - qsort() has no way to pass it
+// along. Reports are only printed from one thread at a time.
+static uint64_t *profileCycles;
+
+// Most cycles first.
+static int compareCycles(const void *a, const void *b) {
+  uint64_t left = profileCycles[*(int *) a];
+  uint64_t right = profileCycles[*(int *) b];
+
+  return left < right ? 1 : left > right ? -1 : 0;
+}
+
+static double percent(uint64_t part, uint64_t total) {
+  return total == 0 ? 0 : 100.0 * part / total;
+}
+
+void printProfile(Profile *profile, FILE *file) {
+  uint64_t totalCount = 0;
+  uint64_t totalCycles = 0;
+
+  for (int i = 0; i < 256; i++) {
+    totalCount += profile->opCounts[i];
+    totalCycles += profile->opCycles[i];
+  }
+
+  fprintf(file, "== profile ==\n");
+  fprintf(file, "%-24s %14s %16s %12s %7s\n", "opcode", "count",
+          CYCLE_UNIT, CYCLE_UNIT "/op", "%");
+
+  int opcodes[256];
+  int opcodeCount = 0;
+
+  for (int i = 0; i < 256; i++) {
+    if (profile->opCounts[i] > 0)
+      opcodes[opcodeCount++] = i;
+  }
+
+  profileCycles = profile->opCycles;
+  qsort(opcodes, opcodeCount, sizeof (int), compareCycles);
+
+  for (int i = 0; i < opcodeCount; i++) {
+    int opcode = opcodes[i];
+    uint64_t count = profile->opCounts[opcode];
+    uint64_t cycles = profile->opCycles[opcode];
+
+    fprintf(file, "%-24s %14llu %16llu %12.1f %6.1f%%\n",
+            opcodeName(opcode), (unsigned long long) count,
+            (unsigned long long) cycles, (double) cycles / count,
+            percent(cycles, totalCycles));
+  }
+
+  fprintf(file, "%-24s %14llu %16llu\n", "total",
+          (unsigned long long) totalCount, (unsigned long long) totalCycles);
+
+  // Then the hottest lines.
+  int *lines = malloc(sizeof (int) * (profile->lineCapacity + 1));
+  int lineCount = 0;
+
+  for (int i = 0; i < profile->lineCapacity; i++) {
+    if (profile->lineCounts[i] > 0)
+      lines[lineCount++] = i;
+  }
+
+  profileCycles = profile->lineCycles;
+  qsort(lines, lineCount, sizeof (int), compareCycles);
+
+  fprintf(file, "\n%-24s %14s %16s %12s %7s\n", "line", "count",
+          CYCLE_UNIT, CYCLE_UNIT "/op", "%");
+
+  for (int i = 0; i < lineCount && i < PROFILE_TOP_LINES; i++) {
+    int line = lines[i];
+    uint64_t count = profile->lineCounts[line];
+    uint64_t cycles = profile->lineCycles[line];
+
+    fprintf(file, "%-24d %14llu %16llu %12.1f %6.1f%%\n", line,
+            (unsigned long long) count, (unsigned long long) cycles,
+            (double) cycles / count, percent(cycles, totalCycles));
+  }
+
+  if (lineCount > PROFILE_TOP_LINES)
+    fprintf(file, "(%d more lines)\n", lineCount - PROFILE_TOP_LINES);
+
+  free(lines);
+}
\ No newline at end of file
@@ -0,0 +1,84 @@
+#ifndef CLOXIM_PROFILER_H
+#define CLOXIM_PROFILER_H
+
+#include <stdio.h>
+
+#include "chunk.h"
+#include "common.h"
+
+// A cheap, steadily increasing clock for timing single instructions.
+// The CPU's cycle counter where there is one, nanoseconds elsewhere.
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define CYCLE_UNIT "cycles"
+#define readCycles() __rdtsc()
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define CYCLE_UNIT "cycles"
+#define readCycles() __rdtsc()
+#else
+#include <time.h>
+#define CYCLE_UNIT "ns"
+
+static inline uint64_t readCycles() {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return (uint64_t) time.tv_sec * 1000000000u + time.tv_nsec;
+}
+#endif
+
+// How often every instruction ran, and how long it took, across
+// every chunk a VM has run since the profile was set up.
+//
+// While a chunk runs, everything is counted per byte offset, which
+// is just an array index. Once it's done, the counts are added up
+// per opcode and per source line - through the chunk's position
+// table - so the VM never looks anything up while it's being timed.
+typedef struct {
+  uint64_t opCounts[256];
+  uint64_t opCycles[256];
+
+  // Indexed by line number.
+  int lineCapacity;
+  uint64_t *lineCounts;
+  uint64_t *lineCycles;
+
+  // Indexed by byte offset in the chunk being run.
+  int offsetCapacity;
+  uint64_t *offsetCounts;
+  uint64_t *offsetCycles;
+
+  // The instruction running now, and when it started. -1 before the
+  // first one.
+  int current;
+  uint64_t started;
+} Profile;
+
+void initProfile(Profile *);
+
+void freeProfile(Profile *);
+
+// Gets ready to count [chunk]'s instructions.
+void startProfile(Profile *, Chunk *);
+
+// Adds up what [chunk] cost since startProfile().
+void endProfile(Profile *, Chunk *);
+
+// Prints the opcodes and the lines that took the longest.
+void printProfile(Profile *, FILE *);
+
+// Called by the VM just before it runs the instruction at [offset].
+// Whatever happened since the last call is charged to the last
+// instruction.
+static inline void profileInstruction(Profile *profile, int offset) {
+  uint64_t now = readCycles();
+
+  if (profile->current >= 0)
+    profile->offsetCycles[profile->current] += now - profile->started;
+
+  profile->offsetCounts[offset]++;
+  profile->current = offset;
+  profile->started = now;
+}
+
+#endif
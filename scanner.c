@@ -1,8 +1,25 @@
+#include <errno.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <string.h>
 
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
 #include "common.h"
+#include "memory.h"
 #include "scanner.h"
+#include "simd.h"
+
+// How much a streaming scanner reads at once.
+#define BLOCK_SIZE (64 * 1024)
+
+// What the window needs on top of the lexeme it keeps: a block, its
+// \0 and the vector reads past that - see SIMD_PADDING.
+#define BLOCK_ROOM (BLOCK_SIZE + 1 + SIMD_PADDING)
 
 // Kind of like a Scanner state struct.
 typedef struct {
@@ -17,9 +34,138 @@ typedef struct {
 
   // Some cache values (if I can call them cache values)
   bool isInInterpolation;
+
+  // Streaming mode. Instead of one big string, the source is a
+  // window over a file descriptor that slides forward as we scan.
+  // [end] is where the window's \0 is - a \0 anywhere else is 
+  // the real end of the source. [fd] is -1 when not streaming.
+  int fd;
+  bool isStreamDone;
+  char *buffer;
+  int bufferCapacity;
+  char *end;
 } Scanner;
 
-Scanner scanner;
+// When streaming, each token's lexeme is copied out of the window,
+// since the window will have moved on by the time the parser looks
+// at it again. The parser only ever looks at the lexemes of its
+// previous and current tokens - anything it keeps, like a string's
+// characters, it copies - so a lexeme only has to last until two
+// more tokens have been scanned. The copies go into a ring of
+// buffers that are reused from one token to the next, so scanning
+// takes the same memory however long the stream is.
+#define LEXEME_SLOTS 2
+
+typedef struct {
+  char *chars;
+  int capacity;
+} LexemeSlot;
+
+// Where each line of the scanned source starts. The scanner fills
+// it in as it counts lines, so error messages can jump straight to
+// the offending line instead of walking the source from the top.
+typedef struct {
+  // The source these offsets belong to. NULL when streaming.
+  char *source;
+
+  // Different every time the index starts over - see
+  // getLineIndexStamp().
+  uint64_t stamp;
+  int count;
+  int capacity;
+
+  // starts[0] is where line 1 starts, and so on.
+  int *starts;
+} LineIndex;
+
+// One of each per thread - see THREAD_LOCAL.
+static THREAD_LOCAL Scanner scanner;
+static THREAD_LOCAL LexemeSlot lexemeSlots[LEXEME_SLOTS];
+static THREAD_LOCAL int nextLexemeSlot;
+static THREAD_LOCAL LineIndex lineIndex;
+
+// Where line index stamps come from. Shared by every thread, so no
+// two indexes anywhere ever get the same one. 0 is never handed out.
+static atomic_uint_fast64_t nextLineIndexStamp = 1;
+
+static void addLineStart(int offset) {
+  // Lines are only ever added in order. Error reporting might
+  // index lines the scanner hasn't reached yet, so the scanner
+  // skips what's already there.
+  if (lineIndex.count > 0 && lineIndex.starts[lineIndex.count - 1] >= offset)
+    return;
+
+  if (lineIndex.capacity < lineIndex.count + 1) {
+    int oldCapacity = lineIndex.capacity;
+    lineIndex.capacity = GROW_CAPACITY(oldCapacity);
+    lineIndex.starts = GROW_ARRAY(int, lineIndex.starts, oldCapacity,
+                                  lineIndex.capacity);
+  }
+
+  lineIndex.starts[lineIndex.count++] = offset;
+}
+
+void resetLineIndex(char *source) {
+  // The array itself is reused from one source to the next.
+  lineIndex.source = source;
+  lineIndex.stamp = atomic_fetch_add(&nextLineIndexStamp, 1);
+  lineIndex.count = 0;
+
+  if (source != NULL)
+    addLineStart(0);
+}
+
+uint64_t getLineIndexStamp() {
+  return lineIndex.stamp;
+}
+
+void useLineIndex(char *source, uint64_t stamp) {
+  // Same stamp, same index: the lines the scanner found are still
+  // good. Anything else might be a stale index for whatever used to
+  // be at [source]'s address.
+  if (stamp == 0 || lineIndex.stamp != stamp || lineIndex.source != source)
+    resetLineIndex(source);
+}
+
+char *getOffendingLine(char *source, int line, int *length) {
+  if (source == NULL || line < 1)
+    return NULL;
+
+  // A source nobody reset the index for is indexed right here, once.
+  // The address alone can't tell a new source from an old one that
+  // was freed, so the scanner resets it for every source it starts
+  // on, and the VM checks the stamp - see useLineIndex().
+  if (lineIndex.source != source)
+    resetLineIndex(source);
+
+  // Index whatever lines are missing up to the one we want.
+  while (lineIndex.count < line) {
+    char *newline = strchr(source + lineIndex.starts[lineIndex.count - 1],
+                           '\n');
+    if (newline == NULL)
+      return NULL;
+
+    addLineStart((int) (newline + 1 - source));
+  }
+
+  char *start = source + lineIndex.starts[line - 1];
+
+  // The next line's start tells us where this one ends - the last
+  // line ends wherever the source does.
+  int lineLength;
+  if (line < lineIndex.count) {
+    lineLength = lineIndex.starts[line] - lineIndex.starts[line - 1] - 1;
+  } else {
+    lineLength = (int) strcspn(start, "\n");
+  }
+
+  // Don't print the \r of a \r\n.
+  if (lineLength > 0 && start[lineLength - 1] == '\r')
+    lineLength--;
+
+  *length = lineLength;
+  return start;
+}
 
 void initScanner(char *source) {
   scanner.start = source;
@@ -28,6 +174,107 @@ void initScanner(char *source) {
   scanner.line = 1;
   scanner.startCol = 1;
   scanner.currentCol = 1;
+  scanner.isInInterpolation = false;
+
+  scanner.fd = -1;
+  scanner.isStreamDone = true;
+  scanner.buffer = NULL;
+  scanner.bufferCapacity = 0;
+  scanner.end = NULL;
+
+  resetLineIndex(source);
+}
+
+void initScannerStream(int fd) {
+  // Start with an empty window - the first peek() fills it.
+  char *buffer = GROW_ARRAY(char, NULL, 0, BLOCK_ROOM);
+  buffer[0] = '\0';
+
+  initScanner(buffer);
+  scanner.fd = fd;
+  scanner.isStreamDone = false;
+  scanner.buffer = buffer;
+  scanner.bufferCapacity = BLOCK_ROOM;
+  scanner.end = buffer;
+
+  // Offsets into a window that keeps moving wouldn't mean anything.
+  resetLineIndex(NULL);
+
+  for (int i = 0; i < LEXEME_SLOTS; i++) {
+    lexemeSlots[i].chars = NULL;
+    lexemeSlots[i].capacity = 0;
+  }
+
+  nextLexemeSlot = 0;
+}
+
+void freeScanner() {
+  if (scanner.fd < 0)
+    return;
+
+  FREE_ARRAY(char, scanner.buffer, scanner.bufferCapacity);
+
+  for (int i = 0; i < LEXEME_SLOTS; i++)
+    FREE_ARRAY(char, lexemeSlots[i].chars, lexemeSlots[i].capacity);
+
+  initScanner(NULL);
+}
+
+// Slides the window forward: the lexeme being scanned moves to the
+// front of the buffer and the next block is read after it. Returns
+// false if the stream has nothing left.
+static bool refill() {
+  if (scanner.isStreamDone)
+    return false;
+
+  int keep = (int) (scanner.end - scanner.start);
+  int offset = (int) (scanner.current - scanner.start);
+  memmove(scanner.buffer, scanner.start, keep);
+
+  // A single lexeme might not fit (think of a huge string), 
+  // so the window grows with it.
+  if (keep + BLOCK_ROOM > scanner.bufferCapacity) {
+    int oldCapacity = scanner.bufferCapacity;
+    scanner.bufferCapacity = keep + BLOCK_ROOM;
+    scanner.buffer = GROW_ARRAY(char, scanner.buffer, oldCapacity, 
+                                scanner.bufferCapacity);
+  }
+
+  int bytesRead;
+  do {
+    bytesRead = (int) read(scanner.fd, scanner.buffer + keep, BLOCK_SIZE);
+  } while (bytesRead < 0 && errno == EINTR);
+
+  if (bytesRead <= 0) {
+    // EOF (or an error, which we treat the same way).
+    scanner.isStreamDone = true;
+    bytesRead = 0;
+  }
+
+  scanner.start = scanner.buffer;
+  scanner.current = scanner.buffer + offset;
+  scanner.end = scanner.buffer + keep + bytesRead;
+  *scanner.end = '\0';
+
+  return bytesRead > 0;
+}
+
+// Copies [chars] out of the window, into the slot the token from two
+// tokens ago had.
+static char *copyLexeme(char *chars, int length) {
+  LexemeSlot *slot = &lexemeSlots[nextLexemeSlot];
+  nextLexemeSlot = (nextLexemeSlot + 1) % LEXEME_SLOTS;
+
+  if (slot->capacity < length + 1) {
+    // What it held is dead, so there's nothing to copy over.
+    FREE_ARRAY(char, slot->chars, slot->capacity);
+    slot->capacity = GROW_CAPACITY(length + 1);
+    slot->chars = GROW_ARRAY(char, NULL, 0, slot->capacity);
+  }
+
+  memcpy(slot->chars, chars, length);
+  slot->chars[length] = '\0';
+  return slot->chars;
 }
 
 static bool isAlpha(char c) {
@@ -43,7 +290,11 @@ static bool isDigit(char c) {
 }
 
 static bool isAtEnd() {
-  return *scanner.current == '\0';
+  if (*scanner.current != '\0')
+    return false;
+
+  // When streaming, this \0 might only be the end of the window.
+  return scanner.current != scanner.end || !refill();
 }
 
 static Token makeToken(TokenType type) {
@@ -56,6 +307,11 @@ static Token makeToken(TokenType type) {
 
   token.line = scanner.line;
   token.column = scanner.startCol;
+
+  // The window will have moved on by the time the parser looks
+  // at this token again.
+  if (scanner.fd >= 0)
+    token.start = copyLexeme(token.start, token.length);
   
   return token;
 }
@@ -72,6 +328,15 @@ static Token errorToken(char *message) {
   return token;
 }
 
+// Counts the new line starting after the '\n' at scanner.current.
+static void newLine() {
+  scanner.line++;
+  scanner.currentCol = 0;
+
+  if (lineIndex.source != NULL)
+    addLineStart((int) (scanner.current + 1 - lineIndex.source));
+}
+
 static char advance() {
   // In addition of advancing, it also
   // returns the previous char after advancing.
@@ -80,7 +345,16 @@ static char advance() {
   return scanner.current[-1];
 }
 
+// Skips [length] characters we already know aren't newlines.
+static void advanceBy(size_t length) {
+  scanner.current += length;
+  scanner.currentCol += (int) length;
+}
+
 static char peek() {
+  if (*scanner.current == '\0' && scanner.current == scanner.end)
+    refill();
+
   return *scanner.current;
 }
 
@@ -88,6 +362,9 @@ static char peekNext() {
   if (isAtEnd()) 
     return '\0';
 
+  if (scanner.current + 1 == scanner.end)
+    refill();
+
   return scanner.current[1];
 }
 
@@ -109,23 +386,30 @@ static bool match(char expected) {
 
 static void skipWhitespace() {
   while (1) {
+    // Nothing before this point has to stay in a streaming window.
+    scanner.start = scanner.current;
+
     char c = peek();
     switch (c) {
       case '\n':
-        scanner.line++;
-        scanner.currentCol = 0;
-        // Not breaking - we are falling through!
+        newLine();
+        advance();
+        break;
+
       case ' ':
       case '\r':
       case '\t':
-        advance();
+        // Indentation and alignment come in runs.
+        advanceBy(spacesRun(scanner.current));
         break;
 
       case '/':
         if (peekNext() == '/') {
           // Comment!
-          while (peek() != '\n' && !isAtEnd()) 
-            advance();
+          while (peek() != '\n' && !isAtEnd()) {
+            scanner.start = scanner.current;
+            advanceBy(lineRun(scanner.current));
+          }
 
         } else
           return;
@@ -138,114 +422,111 @@ static void skipWhitespace() {
   }
 }
 
-static TokenType checkKeyword(int start, int length, char* rest, 
-                             TokenType type) {
-
-  // Just rewording the condition:
-  // If the distance between scanner.current and scanner.start
-  // is the same as start + length and scanner.start offset
-  // to the right by start is the same as rest and has the
-  // length of length:
-  if (scanner.current - scanner.start == start + length &&
-      memcmp(scanner.start + start, rest, length) == 0) {
-
-    return type;
-  }
-
-  return TOKEN_IDENTIFIER;
-}
-
-static TokenType identifierType() {
-  switch (*scanner.start) {
-    case 'a': return checkKeyword(1, 2, "nd", TOKEN_AND);
-    case 'c': 
-      if (scanner.current - scanner.start > 1) {
-        switch (scanner.start[1]) {
-          case 'a':
-            return checkKeyword(2, 2, "se", TOKEN_CASE);
-
-          case 'l':
-            // Don't remove the 'l'. My code must not be 
-            // inappropriate.
-            return checkKeyword(1, 4, "lass", TOKEN_CLASS);
-        }
-      }
-      break;
-
-    case 'd': return checkKeyword(1, 6, "efault", TOKEN_DEFAULT);
-    case 'e': return checkKeyword(1, 3, "lse", TOKEN_ELSE);
-    case 'f':
-      if (scanner.current - scanner.start > 1) {
-        switch (scanner.start[1]) {
-          case 'a': return checkKeyword(2, 3, "lse", TOKEN_FALSE);
-          case 'o': return checkKeyword(2, 1, "r", TOKEN_FOR);
-          case 'u': return checkKeyword(2, 1, "n", TOKEN_FUN);
-        }
-      }
-      break;
-
-    case 't':
-      if (scanner.current - scanner.start > 1) {
-        switch (scanner.start[1]) {
-          case 'h': return checkKeyword(2, 2, "is", TOKEN_THIS);
-          case 'r': return checkKeyword(2, 2, "ue", TOKEN_TRUE);
-        }
-      }
-      break;
-
-    case 'i': 
-      if (scanner.current - scanner.start == 2) {
-        switch (scanner.start[1]) {
-          case 'f':
-            // checkKeyword(2, 0, "", TOKEN_IF)
-            // would be weird, wouldn't it?
-            return checkKeyword(1, 1, "f", TOKEN_IF);
+// Keywords are recognized with a perfect hash of their first and
+// last characters and their length: every keyword gets its own slot
+// in the table, so checking an identifier takes one hash and one
+// comparison, however many keywords Loxim grows.
+//
+// The slots are computed by the C compiler from KEYWORD_HASH(), and
+// the static assertions below stop the build if two keywords land in
+// the same one - pick new multipliers then.
+#define KEYWORD_HASH(first, last, length) \
+  (((first) + 2 * (last) + 5 * (length)) & 63)
+
+// Every keyword, as X(name, first, last, type).
+#define KEYWORDS(X) \
+  X("and",        'a', 'd', TOKEN_AND) \
+  X("case",       'c', 'e', TOKEN_CASE) \
+  X("class",      'c', 's', TOKEN_CLASS) \
+  X("default",    'd', 't', TOKEN_DEFAULT) \
+  X("else",       'e', 'e', TOKEN_ELSE) \
+  X("false",      'f', 'e', TOKEN_FALSE) \
+  X("for",        'f', 'r', TOKEN_FOR) \
+  X("fun",        'f', 'n', TOKEN_FUN) \
+  X("if",         'i', 'f', TOKEN_IF) \
+  X("in",         'i', 'n', TOKEN_IN) \
+  X("instanceof", 'i', 'f', TOKEN_INSTANCEOF) \
+  X("nil",        'n', 'l', TOKEN_NIL) \
+  X("nmut",       'n', 't', TOKEN_NMUT) \
+  X("or",         'o', 'r', TOKEN_OR) \
+  X("print",      'p', 't', TOKEN_PRINT) \
+  X("return",     'r', 'n', TOKEN_RETURN) \
+  X("super",      's', 'r', TOKEN_SUPER) \
+  X("switch",     's', 'h', TOKEN_SWITCH) \
+  X("this",       't', 's', TOKEN_THIS) \
+  X("true",       't', 'e', TOKEN_TRUE) \
+  X("var",        'v', 'r', TOKEN_VAR) \
+  X("while",      'w', 'e', TOKEN_WHILE)
+
+#define KEYWORD_SLOT(name, first, last) \
+  KEYWORD_HASH(first, last, sizeof (name) - 1)
+
+// A keyword's slot as a bit, if it's in the lower (half 0) or upper
+// (half 1) 32 slots.
+#define KEYWORD_BIT(name, first, last, half) \
+  (KEYWORD_SLOT(name, first, last) / 32 == (half) ? \
+    (uint64_t) 1 << (KEYWORD_SLOT(name, first, last) % 32) : 0)
+
+#define SUM_LOWER(name, first, last, type) + KEYWORD_BIT(name, first, last, 0)
+#define SUM_UPPER(name, first, last, type) + KEYWORD_BIT(name, first, last, 1)
+#define OR_LOWER(name, first, last, type) | KEYWORD_BIT(name, first, last, 0)
+#define OR_UPPER(name, first, last, type) | KEYWORD_BIT(name, first, last, 1)
+
+// Adding up the slots' bits only gives the same as OR-ing them when
+// no bit is there twice. Each half's sum fits in 64 bits, so a
+// collision can't overflow its way back to a match.
+_Static_assert((0 KEYWORDS(SUM_LOWER)) == (0 KEYWORDS(OR_LOWER)),
+               "two keywords share a slot - change KEYWORD_HASH()");
+_Static_assert((0 KEYWORDS(SUM_UPPER)) == (0 KEYWORDS(OR_UPPER)),
+               "two keywords share a slot - change KEYWORD_HASH()");
+
+#undef SUM_LOWER
+#undef SUM_UPPER
+#undef OR_LOWER
+#undef OR_UPPER
+#undef KEYWORD_BIT
 
-          case 'n':
-            return checkKeyword(1, 1, "n", TOKEN_IN);
-        }
-      } else if (scanner.current - scanner.start > 1)
-        return checkKeyword(1, 9, "nstanceof", TOKEN_INSTANCEOF);
+typedef struct {
+  char *name;
+  int length;
+  TokenType type;
+} Keyword;
 
-      break;
+#define KEYWORD(name, first, last, type) \
+  [KEYWORD_SLOT(name, first, last)] = {name, sizeof (name) - 1, type},
 
-    case 'n': 
-      if (scanner.current - scanner.start > 1) {
-        switch (scanner.start[1]) {
-          case 'i':
-            return checkKeyword(2, 1, "l", TOKEN_NIL);
+static const Keyword keywords[64] = {
+  KEYWORDS(KEYWORD)
+};
 
-          case 'm':
-            return checkKeyword(2, 2, "ut", TOKEN_NMUT);
-        }
-      }
-      break;
+#undef KEYWORD
+#undef KEYWORD_SLOT
+#undef KEYWORDS
 
-    case 'o': return checkKeyword(1, 1, "r", TOKEN_OR);
-    case 'p': return checkKeyword(1, 4, "rint", TOKEN_PRINT);
-    case 'r': return checkKeyword(1, 5, "eturn", TOKEN_RETURN);
-    case 's':       
-    if (scanner.current - scanner.start > 1) {
-        switch (scanner.start[1]) {
-          case 'u':
-            return checkKeyword(2, 3, "per", TOKEN_SUPER);
-
-          case 'w':
-            return checkKeyword(2, 4, "itch", TOKEN_SWITCH);
-        }
-      }
-      break;
-
-    case 'v': return checkKeyword(1, 2, "ar", TOKEN_VAR);
-    case 'w': return checkKeyword(1, 4, "hile", TOKEN_WHILE);
+static TokenType identifierType() {
+  int length = (int) (scanner.current - scanner.start);
+  uint8_t first = (uint8_t) scanner.start[0];
+  uint8_t last = (uint8_t) scanner.start[length - 1];
+
+  // Empty slots have a length of 0, which never matches.
+  const Keyword *keyword = &keywords[KEYWORD_HASH(first, last, length)];
+  if (keyword->length != length)
+    return TOKEN_IDENTIFIER;
+
+  // Keywords are short - a plain loop beats calling memcmp().
+  for (int i = 0; i < length; i++) {
+    if (scanner.start[i] != keyword->name[i])
+      return TOKEN_IDENTIFIER;
   }
 
-  return TOKEN_IDENTIFIER;
+  return keyword->type;
 }
 
 static Token identifier() {
+  // The run might stop at the end of a streaming window, in which
+  // case peek() pulls in more and we keep going.
   while (isAlpha(peek()) || isDigit(peek()))
-    advance();
+    advanceBy(identifierRun(scanner.current));
 
   // identifierType() will check for us if 
   // we are on a keyword or an identifier.
@@ -253,8 +534,10 @@ static Token identifier() {
 }
 
 static Token number() {
+  // Like identifier(), a run can stop at the end of a streaming
+  // window, and peek() pulls in more.
   while (isDigit(peek()))
-    advance();
+    advanceBy(digitsRun(scanner.current));
 
   // Is there a fractional part?
   if (peek() == '.' && isDigit(peekNext())) {
@@ -262,7 +545,7 @@ static Token number() {
     advance();
 
     while (isDigit(peek()))
-      advance();
+      advanceBy(digitsRun(scanner.current));
   }
 
   return makeToken(TOKEN_NUMBER);
@@ -279,11 +562,18 @@ static Token string() {
     // (Yes, any Lox code is valid in Loxim, except for)
     // (a few edge cases (try declaring a local and))
     // ((not using it))
-    if (peek() == '\n') {
-      scanner.currentCol = 0;
-      scanner.line++;
+
+    // Skip the plain characters in one go. Only newlines and '$'s
+    // need a closer look.
+    size_t run = stringRun(scanner.current);
+    if (run > 0) {
+      advanceBy(run);
+      continue;
     }
 
+    if (peek() == '\n')
+      newLine();
+
     // String interpolation.
     if (peek() == '$') {
       if (peekNext() != '{')
@@ -335,8 +625,6 @@ Token scanToken() {
       // If we are on an interpolated expression, 
       // this is the end of the interpolated expression.
       // What's left is the rest of the "parent" string.
-      advance();
-
       if (scanner.isInInterpolation) {
         scanner.isInInterpolation = false;
         return string();
@@ -370,4 +658,174 @@ Token scanToken() {
   }
 
   return errorToken("Unexpected character.");  
+}
+
+void initTokenBuffer(TokenBuffer *buffer, char *source) {
+  initScanner(source);
+
+  buffer->source = source;
+  buffer->first = 0;
+  buffer->count = 0;
+  buffer->capacity = 0;
+  buffer->discardBefore = 0;
+  buffer->types = NULL;
+  buffer->offsets = NULL;
+  buffer->lengths = NULL;
+  buffer->lines = NULL;
+  buffer->columns = NULL;
+
+  buffer->errorCount = 0;
+  buffer->errorCapacity = 0;
+  buffer->errors = NULL;
+
+  buffer->isDone = false;
+}
+
+void scanTokens(TokenBuffer *buffer, int count) {
+  for (int i = 0; i < count && !buffer->isDone; i++) {
+    Token token = scanToken();
+
+    if (buffer->capacity < buffer->count + 1) {
+      int oldCapacity = buffer->capacity;
+      buffer->capacity = GROW_CAPACITY(oldCapacity);
+
+      buffer->types = GROW_ARRAY(uint8_t, buffer->types, oldCapacity, 
+                                 buffer->capacity);
+      buffer->offsets = GROW_ARRAY(int, buffer->offsets, oldCapacity, 
+                                   buffer->capacity);
+      buffer->lengths = GROW_ARRAY(int, buffer->lengths, oldCapacity, 
+                                   buffer->capacity);
+      buffer->lines = GROW_ARRAY(int, buffer->lines, oldCapacity, 
+                                 buffer->capacity);
+      buffer->columns = GROW_ARRAY(int, buffer->columns, oldCapacity, 
+                                   buffer->capacity);
+    }
+
+    int offset;
+    if (token.type == TOKEN_ERROR) {
+      // The lexeme is the error message, which isn't in the source.
+      if (buffer->errorCapacity < buffer->errorCount + 1) {
+        int oldCapacity = buffer->errorCapacity;
+        buffer->errorCapacity = GROW_CAPACITY(oldCapacity);
+        buffer->errors = GROW_ARRAY(char *, buffer->errors, oldCapacity,
+                                    buffer->errorCapacity);
+      }
+
+      offset = buffer->errorCount;
+      buffer->errors[buffer->errorCount++] = token.start;
+    } else {
+      offset = (int) (token.start - buffer->source);
+    }
+
+    int index = buffer->count++;
+    buffer->types[index] = (uint8_t) token.type;
+    buffer->offsets[index] = offset;
+    buffer->lengths[index] = token.length;
+    buffer->lines[index] = token.line;
+    buffer->columns[index] = token.column;
+
+    buffer->isDone = token.type == TOKEN_EOF;
+  }
+}
+
+void discardTokens(TokenBuffer *buffer, int index) {
+  if (index > buffer->discardBefore)
+    buffer->discardBefore = index;
+}
+
+// Drops the tokens discardTokens() said are done with.
+static void dropDiscarded(TokenBuffer *buffer) {
+  int dropped = buffer->discardBefore - buffer->first;
+  if (dropped <= 0)
+    return;
+
+  if (dropped > buffer->count)
+    dropped = buffer->count;
+
+  // Usually only the parser's previous and current tokens are left
+  // to move - it needs more once it has used up the ones it has.
+  int kept = buffer->count - dropped;
+  memmove(buffer->types, buffer->types + dropped, kept * sizeof (uint8_t));
+  memmove(buffer->offsets, buffer->offsets + dropped, kept * sizeof (int));
+  memmove(buffer->lengths, buffer->lengths + dropped, kept * sizeof (int));
+  memmove(buffer->lines, buffer->lines + dropped, kept * sizeof (int));
+  memmove(buffer->columns, buffer->columns + dropped, kept * sizeof (int));
+
+  buffer->first += dropped;
+  buffer->count = kept;
+}
+
+// How many tokens are scanned at once when a lookup runs past the
+// ones in the buffer.
+#define TOKEN_BATCH 256
+
+int findToken(TokenBuffer *buffer, int index) {
+  if (index < buffer->first)
+    return -1;
+
+  while (index >= buffer->first + buffer->count && !buffer->isDone) {
+    dropDiscarded(buffer);
+    scanTokens(buffer, TOKEN_BATCH);
+  }
+
+  // Keep handing out TOKEN_EOF, like scanToken() does. It's never
+  // dropped - nothing is, once the scanner is done.
+  int slot = index - buffer->first;
+  if (slot >= buffer->count)
+    slot = buffer->count - 1;
+
+  return slot;
+}
+
+Token getToken(TokenBuffer *buffer, int index) {
+  int slot = getTokenSlot(buffer, index);
+
+  Token token;
+  if (slot < 0) {
+    token.type = TOKEN_ERROR;
+    token.start = "Token was already discarded.";
+    token.length = (int) strlen(token.start);
+    token.line = 0;
+    token.column = 0;
+    return token;
+  }
+
+  token.type = (TokenType) buffer->types[slot];
+  token.length = buffer->lengths[slot];
+  token.line = buffer->lines[slot];
+  token.column = buffer->columns[slot];
+
+  if (token.type == TOKEN_ERROR) {
+    token.start = buffer->errors[buffer->offsets[slot]];
+  } else {
+    token.start = buffer->source + buffer->offsets[slot];
+  }
+
+  return token;
+}
+
+void freeTokenBuffer(TokenBuffer *buffer) {
+  FREE_ARRAY(uint8_t, buffer->types, buffer->capacity);
+  FREE_ARRAY(int, buffer->offsets, buffer->capacity);
+  FREE_ARRAY(int, buffer->lengths, buffer->capacity);
+  FREE_ARRAY(int, buffer->lines, buffer->capacity);
+  FREE_ARRAY(int, buffer->columns, buffer->capacity);
+  FREE_ARRAY(char *, buffer->errors, buffer->errorCapacity);
+
+  // Without starting the scanner over, which would throw away the
+  // line index the VM can still use.
+  buffer->source = NULL;
+  buffer->first = 0;
+  buffer->count = 0;
+  buffer->capacity = 0;
+  buffer->discardBefore = 0;
+  buffer->types = NULL;
+  buffer->offsets = NULL;
+  buffer->lengths = NULL;
+  buffer->lines = NULL;
+  buffer->columns = NULL;
+  buffer->errorCount = 0;
+  buffer->errorCapacity = 0;
+  buffer->errors = NULL;
+  buffer->isDone = true;
 }
\ No newline at end of file
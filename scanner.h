@@ -1,6 +1,10 @@
 #ifndef CLOXIM_SCANNER_H
 #define CLOXIM_SCANNER_H
 
+#include <stdint.h>
+
+#include "common.h"
+
 // Get ready for this long list of tokens.
 
 typedef enum {
@@ -37,8 +41,130 @@ typedef struct {
   int column;
 } Token;
 
+// Tokens scanned ahead of the parser, in batches. Every field gets
+// its own array, so looking through token types doesn't drag the
+// lexemes, lines and columns through the cache with them. Any token
+// can be looked up by index, however far ahead.
+typedef struct {
+  char *source;
+
+  // The index of the token in slot 0. Tokens the parser is done
+  // with are discarded, so the buffer stays small.
+  int first;
+  int count;
+  int capacity;
+
+  // Tokens before this one can go the next time the buffer needs
+  // room - see discardTokens().
+  int discardBefore;
+
+  // TokenType always fits in a byte.
+  uint8_t *types;
+
+  // Where each lexeme starts in [source]. For TOKEN_ERROR, it's an
+  // index in [errors] instead.
+  int *offsets;
+  int *lengths;
+  int *lines;
+  int *columns;
+
+  // Messages of the TOKEN_ERROR tokens.
+  int errorCount;
+  int errorCapacity;
+  char **errors;
+
+  // Whether TOKEN_EOF is in the buffer yet.
+  bool isDone;
+} TokenBuffer;
+
 void initScanner(char *source);
 
+// Sets up the scanner for [source] and an empty buffer for its tokens.
+void initTokenBuffer(TokenBuffer *buffer, char *source);
+
+// Scans up to [count] more tokens into the buffer. Nothing is
+// scanned past TOKEN_EOF. Looking a token up scans as far as it
+// needs to anyway - this is only for scanning ahead early.
+void scanTokens(TokenBuffer *buffer, int count);
+
+// Says every token before [index] is done with. They aren't dropped
+// straight away - that happens the next time the buffer needs room
+// for more - so calling this after every token costs nothing.
+void discardTokens(TokenBuffer *buffer, int index);
+
+// Finds the slot token [index] is in, scanning forward until it's
+// there. Indexes past TOKEN_EOF find TOKEN_EOF's slot. Returns -1
+// for a token that was already discarded.
+int findToken(TokenBuffer *buffer, int index);
+
+// findToken(), without the call for tokens that are already there -
+// which is almost every one.
+static inline int getTokenSlot(TokenBuffer *buffer, int index) {
+  int slot = index - buffer->first;
+
+  if (slot >= 0 && slot < buffer->count)
+    return slot;
+
+  return findToken(buffer, index);
+}
+
+// Single fields of token [index], straight from their arrays, for
+// the parser's hot paths. A discarded token is a TOKEN_ERROR on
+// line 0.
+static inline TokenType getTokenType(TokenBuffer *buffer, int index) {
+  int slot = getTokenSlot(buffer, index);
+  return slot < 0 ? TOKEN_ERROR : (TokenType) buffer->types[slot];
+}
+
+static inline int getTokenLine(TokenBuffer *buffer, int index) {
+  int slot = getTokenSlot(buffer, index);
+  return slot < 0 ? 0 : buffer->lines[slot];
+}
+
+static inline int getTokenColumn(TokenBuffer *buffer, int index) {
+  int slot = getTokenSlot(buffer, index);
+  return slot < 0 ? 0 : buffer->columns[slot];
+}
+
+// Retrieves the whole of token [index].
+Token getToken(TokenBuffer *buffer, int index);
+
+void freeTokenBuffer(TokenBuffer *buffer);
+
+// Finds line [line] of [source] for error messages, without copying
+// it. Returns a pointer to its first character and stores its 
+// length (without the newline) in [length], or returns NULL if
+// there's no such line.
+char *getOffendingLine(char *source, int line, int *length);
+
+// Starts this thread's line index over for [source]. The index is
+// only keyed by the source's address, and a new source - the REPL's
+// next line, or a file mapped where a freed one was - can get the
+// same one, so anything that's about to report errors against a
+// source calls this or useLineIndex() first. initScanner() does.
+void resetLineIndex(char *source);
+
+// Identifies this thread's line index as it is now. Every reset
+// gets a new stamp, so a compiler that records it right after
+// initScanner() can tell later whether the index is still the one
+// built while scanning its source. Never 0.
+uint64_t getLineIndexStamp();
+
+// Gets this thread's line index ready for errors against [source].
+// If it still has [stamp], the lines found while scanning are kept;
+// otherwise - a cached chunk, which was never scanned, passes 0 - it
+// starts over.
+void useLineIndex(char *source, uint64_t stamp);
+
+// Scans a file descriptor (a pipe, for example) one block at a time
+// instead of a string in memory. Tokens point to copies of their
+// lexemes, which are only good until two more tokens have been
+// scanned.
+void initScannerStream(int fd);
+
+// Frees what a streaming scanner allocated.
+void freeScanner();
+
 Token scanToken();
 
 #endif
\ No newline at end of file
@@ -0,0 +1,243 @@
+#include <stdint.h>
+
+#include "simd.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__) && \
+    !defined(LOXIM_NO_SIMD)
+#define SIMD_X86
+#include <immintrin.h>
+#endif
+
+// The kinds of runs we know how to skip.
+typedef enum {
+  RUN_SPACES,
+  RUN_IDENTIFIER,
+  RUN_DIGITS,
+  RUN_LINE,
+  RUN_STRING
+} RunKind;
+
+// The scalar version - a lookup table with one bit per kind of
+// run, set for every character that belongs to it. It's built by
+// the preprocessor rather than on first use, so threads scanning
+// at the same time never race to fill it in.
+#define IS_SPACE(c) ((c) == ' ' || (c) == '\t' || (c) == '\r')
+
+#define IS_IDENTIFIER(c) \
+  (((c) >= 'a' && (c) <= 'z') || ((c) >= 'A' && (c) <= 'Z') || \
+   ((c) >= '0' && (c) <= '9') || (c) == '_')
+
+// runTable[0] is 0: \0 ends every run.
+#define RUN_BITS(c) ((c) == 0 ? 0 : \
+  (IS_SPACE(c) << RUN_SPACES) | \
+  (IS_IDENTIFIER(c) << RUN_IDENTIFIER) | \
+  (((c) >= '0' && (c) <= '9') << RUN_DIGITS) | \
+  (((c) != '\n') << RUN_LINE) | \
+  (((c) != '\n' && (c) != '"' && (c) != '$') << RUN_STRING))
+
+#define RUN_BITS_4(c) \
+  RUN_BITS(c), RUN_BITS((c) + 1), RUN_BITS((c) + 2), RUN_BITS((c) + 3)
+#define RUN_BITS_16(c) \
+  RUN_BITS_4(c), RUN_BITS_4((c) + 4), RUN_BITS_4((c) + 8), \
+  RUN_BITS_4((c) + 12)
+#define RUN_BITS_64(c) \
+  RUN_BITS_16(c), RUN_BITS_16((c) + 16), RUN_BITS_16((c) + 32), \
+  RUN_BITS_16((c) + 48)
+
+static const uint8_t runTable[256] = {
+  RUN_BITS_64(0), RUN_BITS_64(64), RUN_BITS_64(128), RUN_BITS_64(192)
+};
+
+static size_t scalarRun(char *start, RunKind kind) {
+  char *c = start;
+  while (runTable[(uint8_t) *c] & (1 << kind))
+    c++;
+
+  return (size_t) (c - start);
+}
+
+#ifdef SIMD_X86
+
+// The vector versions work on aligned blocks. An aligned load can
+// never cross into the next page, so reading past the \0 at the end
+// of a source (or of a mapped file) can't fault. The bytes before
+// [start] in the first block are masked out.
+
+// Whether [c] is in [low, high]. Bytes above 0x7f are negative as
+// signed chars, so they're never in any of our ranges.
+#define SSE_IN_RANGE(c, low, high) \
+  _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8((low) - 1)), \
+                _mm_cmplt_epi8(c, _mm_set1_epi8((high) + 1)))
+
+#define SSE_IS(c, ch) _mm_cmpeq_epi8(c, _mm_set1_epi8(ch))
+
+// One bit per byte of [block] that ends a run of [kind].
+__attribute__((target("sse2"), always_inline))
+static inline uint32_t sseStops(__m128i block, RunKind kind) {
+  __m128i members;
+
+  switch (kind) {
+    case RUN_SPACES:
+      members = _mm_or_si128(_mm_or_si128(SSE_IS(block, ' '), 
+                             SSE_IS(block, '\t')), SSE_IS(block, '\r'));
+      break;
+
+    case RUN_IDENTIFIER: {
+      // Setting bit 5 turns upper case letters into lower case ones.
+      __m128i lower = _mm_or_si128(block, _mm_set1_epi8(0x20));
+      members = _mm_or_si128(_mm_or_si128(SSE_IN_RANGE(lower, 'a', 'z'), 
+                             SSE_IN_RANGE(block, '0', '9')), 
+                             SSE_IS(block, '_'));
+      break;
+    }
+
+    case RUN_DIGITS:
+      members = SSE_IN_RANGE(block, '0', '9');
+      break;
+
+    case RUN_LINE:
+      return (uint32_t) _mm_movemask_epi8(_mm_or_si128(
+             SSE_IS(block, '\n'), SSE_IS(block, '\0')));
+
+    case RUN_STRING:
+      return (uint32_t) _mm_movemask_epi8(_mm_or_si128(
+             _mm_or_si128(SSE_IS(block, '"'), SSE_IS(block, '\n')), 
+             _mm_or_si128(SSE_IS(block, '$'), SSE_IS(block, '\0'))));
+  }
+
+  // \0 is never a member, so it always stops.
+  return ~(uint32_t) _mm_movemask_epi8(members) & 0xffff;
+}
+
+__attribute__((target("sse2"), always_inline))
+static inline size_t sseRun(char *start, RunKind kind) {
+  uintptr_t misalignment = (uintptr_t) start & 15;
+  char *block = start - misalignment;
+
+  uint32_t stops = sseStops(_mm_load_si128((__m128i *) block), kind);
+  stops &= ~0u << misalignment;
+
+  while (stops == 0) {
+    block += 16;
+    stops = sseStops(_mm_load_si128((__m128i *) block), kind);
+  }
+
+  return (size_t) (block + __builtin_ctz(stops) - start);
+}
+
+#define AVX_IN_RANGE(c, low, high) \
+  _mm256_and_si256(_mm256_cmpgt_epi8(c, _mm256_set1_epi8((low) - 1)), \
+                   _mm256_cmpgt_epi8(_mm256_set1_epi8((high) + 1), c))
+
+#define AVX_IS(c, ch) _mm256_cmpeq_epi8(c, _mm256_set1_epi8(ch))
+
+__attribute__((target("avx2"), always_inline))
+static inline uint32_t avxStops(__m256i block, RunKind kind) {
+  __m256i members;
+
+  switch (kind) {
+    case RUN_SPACES:
+      members = _mm256_or_si256(_mm256_or_si256(AVX_IS(block, ' '), 
+                AVX_IS(block, '\t')), AVX_IS(block, '\r'));
+      break;
+
+    case RUN_IDENTIFIER: {
+      __m256i lower = _mm256_or_si256(block, _mm256_set1_epi8(0x20));
+      members = _mm256_or_si256(_mm256_or_si256(
+                AVX_IN_RANGE(lower, 'a', 'z'), AVX_IN_RANGE(block, '0', '9')), 
+                AVX_IS(block, '_'));
+      break;
+    }
+
+    case RUN_DIGITS:
+      members = AVX_IN_RANGE(block, '0', '9');
+      break;
+
+    case RUN_LINE:
+      return (uint32_t) _mm256_movemask_epi8(_mm256_or_si256(
+             AVX_IS(block, '\n'), AVX_IS(block, '\0')));
+
+    case RUN_STRING:
+      return (uint32_t) _mm256_movemask_epi8(_mm256_or_si256(
+             _mm256_or_si256(AVX_IS(block, '"'), AVX_IS(block, '\n')), 
+             _mm256_or_si256(AVX_IS(block, '$'), AVX_IS(block, '\0'))));
+  }
+
+  return ~(uint32_t) _mm256_movemask_epi8(members);
+}
+
+__attribute__((target("avx2"), always_inline))
+static inline size_t avxRun(char *start, RunKind kind) {
+  uintptr_t misalignment = (uintptr_t) start & 31;
+  char *block = start - misalignment;
+
+  uint32_t stops = avxStops(_mm256_load_si256((__m256i *) block), kind);
+  stops &= ~0u << misalignment;
+
+  while (stops == 0) {
+    block += 32;
+    stops = avxStops(_mm256_load_si256((__m256i *) block), kind);
+  }
+
+  return (size_t) (block + __builtin_ctz(stops) - start);
+}
+
+// The best version this machine supports. Picked on first use, by
+// each thread - they'd all pick the same one anyway.
+typedef enum {
+  SIMD_UNKNOWN,
+  SIMD_NONE,
+  SIMD_SSE2,
+  SIMD_AVX2
+} SimdLevel;
+
+static THREAD_LOCAL SimdLevel simdLevel = SIMD_UNKNOWN;
+
+static SimdLevel detectSimd() {
+  __builtin_cpu_init();
+
+  if (__builtin_cpu_supports("avx2"))
+    return SIMD_AVX2;
+
+  if (__builtin_cpu_supports("sse2"))
+    return SIMD_SSE2;
+
+  return SIMD_NONE;
+}
+
+// How many characters are checked one at a time before switching
+// to vectors. Short runs (a single space between two tokens, a 
+// short identifier) are far more common than long ones, and the
+// table beats setting up a vector for those.
+#define SHORT_RUN 16
+
+#define DEFINE_RUN(name, kind) \
+  __attribute__((target("avx2"))) \
+  static size_t name##Avx(char *start) { return avxRun(start, kind); } \
+  \
+  __attribute__((target("sse2"))) \
+  static size_t name##Sse(char *start) { return sseRun(start, kind); } \
+  \
+  size_t name(char *start) { \
+    for (size_t i = 0; i < SHORT_RUN; i++) { \
+      if (!(runTable[(uint8_t) start[i]] & (1 << kind))) \
+        return i; \
+    } \
+    if (simdLevel == SIMD_UNKNOWN) \
+      simdLevel = detectSimd(); \
+    switch (simdLevel) { \
+      case SIMD_AVX2: return SHORT_RUN + name##Avx(start + SHORT_RUN); \
+      case SIMD_SSE2: return SHORT_RUN + name##Sse(start + SHORT_RUN); \
+      default:        return SHORT_RUN + scalarRun(start + SHORT_RUN, kind); \
+    } \
+  }
+#else
+#define DEFINE_RUN(name, kind) \
+  size_t name(char *start) { return scalarRun(start, kind); }
+#endif
+
+DEFINE_RUN(spacesRun, RUN_SPACES)
+DEFINE_RUN(identifierRun, RUN_IDENTIFIER)
+DEFINE_RUN(digitsRun, RUN_DIGITS)
+DEFINE_RUN(lineRun, RUN_LINE)
+DEFINE_RUN(stringRun, RUN_STRING)
@@ -0,0 +1,38 @@
+#ifndef CLOXIM_SIMD_H
+#define CLOXIM_SIMD_H
+
+#include "common.h"
+
+// Vectorized helpers for the scanner. Each one returns how many
+// characters, starting at [start], belong to a run of some kind
+// of character. They read up to 32 bytes at a time, picking AVX2 
+// or SSE2 at runtime, and fall back to a plain loop on other 
+// machines (or when built with LOXIM_NO_SIMD).
+//
+// [start] must point into a \0-terminated string. A \0 always 
+// ends a run.
+
+// The vector versions read whole aligned blocks, so they can look at
+// up to 31 bytes past the \0. That never faults - an aligned block
+// can't cross into the next page - but buffers the scanner reads
+// from leave this much room after the \0 anyway, so tools like
+// AddressSanitizer don't flag the reads.
+#define SIMD_PADDING 32
+
+// Spaces, tabs and carriage returns - but not newlines, since the
+// scanner has to count those.
+size_t spacesRun(char *start);
+
+// Letters, digits and underscores.
+size_t identifierRun(char *start);
+
+// Decimal digits - for number literals.
+size_t digitsRun(char *start);
+
+// Anything but a newline - for comment bodies.
+size_t lineRun(char *start);
+
+// Anything but a quote, a newline or a '$' - for string contents.
+size_t stringRun(char *start);
+
+#endif
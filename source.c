@@ -0,0 +1,110 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "simd.h"
+#include "source.h"
+
+static bool copyFile(char *path, Source *source, FILE *errors) {
+  // Open the file
+  FILE *file = fopen(path, "rb");
+
+  if (file == NULL) {
+    fprintf(errors, "Could not open \"%s\". Make sure you're in the correct"
+            " directory.\n", path);
+    
+    // No need to close it - it is already NULL.
+    return false;
+  }
+
+  // Calculate its size.
+  fseek(file, 0L, SEEK_END);
+  size_t fileSize = ftell(file);
+  rewind(file);
+
+  // Read the file
+  char *buf = malloc(fileSize + 1 + SIMD_PADDING); // +1 for \0
+
+  if (buf == NULL) {
+    fprintf(errors, "Not enough memory to read \"%s\". "
+                    "(File size %zu bytes + 1)\n", path, fileSize);
+    
+    fclose(file);
+    return false;
+  }
+
+  size_t bytesRead = fread(buf, sizeof (char), fileSize, file);
+  fclose(file);
+  
+  if (bytesRead < fileSize) {
+    fprintf(errors, "Failed to read \"%s\". This issue is unlikely.\n", path);
+    free(buf);
+    return false;
+  }
+
+  buf[bytesRead] = '\0';
+
+  // Return it.
+  *source = (Source) {buf, bytesRead, false};
+  return true;
+}
+
+bool loadSource(char *path, Source *source, FILE *errors) {
+#ifndef _WIN32
+  // Mapping the file lets the scanner read it straight from the
+  // page cache, without copying it into our own buffer first.
+  //
+  // The kernel fills the rest of the last page with zeroes, which
+  // gives us our \0 for free - unless the file ends exactly on a
+  // page boundary. Those (and empty files) are copied instead.
+  int fd = open(path, O_RDONLY);
+
+  if (fd >= 0) {
+    struct stat info;
+    long pageSize = sysconf(_SC_PAGESIZE);
+    char *text = MAP_FAILED;
+
+    if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && 
+        info.st_size > 0 && info.st_size % pageSize != 0) {
+
+      text = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+
+    // The mapping stays valid after the descriptor is closed.
+    close(fd);
+
+    if (text != MAP_FAILED) {
+      *source = (Source) {text, (size_t) info.st_size, true};
+      return true;
+    }
+  }
+#endif
+
+  return copyFile(path, source, errors);
+}
+
+Source readFile(char *path) {
+  Source source;
+
+  if (!loadSource(path, &source, stderr))
+    exit(74);
+
+  return source;
+}
+
+void freeSource(Source *source) {
+#ifndef _WIN32
+  if (source->isMapped) {
+    munmap(source->text, source->length);
+    return;
+  }
+#endif
+
+  free(source->text);
+}
\ No newline at end of file
@@ -0,0 +1,27 @@
+#ifndef CLOXIM_SOURCE_H
+#define CLOXIM_SOURCE_H
+
+#include <stdio.h>
+
+#include "common.h"
+
+// A script's source code. It's either mapped straight from the
+// file or copied into a heap buffer - either way, it ends with
+// a \0, because the scanner relies on that to stop.
+typedef struct {
+  char *text;
+  size_t length;
+  bool isMapped;
+} Source;
+
+// Reads a whole script into [source]. If it can't be read, says
+// why on [errors] and returns false.
+bool loadSource(char *path, Source *source, FILE *errors);
+
+// Reads a whole script. Exits with 74 if it can't be read.
+Source readFile(char *path);
+
+// Gives back whatever readFile() took.
+void freeSource(Source *source);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,183 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+// Checks the stack depth worked out for chunks with more than 256
+// constants - by the compiler, by verifyChunk() and after a trip
+// through the cache format - and that verifyChunk() turns down
+// broken code.
+//
+// Run it with `make test`, or build it from the repository root:
+//
+//   cc -O2 -I. -o test-chunk tests/chunk.c cache.c chunk.c compiler.c
+//      debug.c memory.c object.c profiler.c scanner.c simd.c value.c
+//      vm.c
+
+#include "common.h"
+#include "cache.h"
+#include "chunk.h"
+#include "compiler.h"
+
+#define CONSTANTS 300
+
+static int failures = 0;
+
+#define CHECK(condition) \
+  do { \
+    if (!(condition)) { \
+      fprintf(stderr, "%s:%d: failed: %s\n", __FILE__, __LINE__, \
+              #condition); \
+      failures++; \
+    } \
+  } while (false)
+
+// nil * 0.5 + nil * 1.5 + ... Multiplying by nil stops the constants
+// from being folded away, so the pool ends up past 256.
+static void compiledChunk() {
+  size_t size = CONSTANTS * 16 + 1;
+  char *source = malloc(size);
+  if (source == NULL)
+    exit(1);
+
+  int length = 0;
+  for (int i = 0; i < CONSTANTS; i++) {
+    length += snprintf(source + length, size - length, "%snil * %d.5",
+                       i > 0 ? " + " : "", i);
+  }
+
+  Chunk chunk;
+  initChunk(&chunk);
+  CHECK(compile(source, &chunk));
+  CHECK(chunk.constants.count == CONSTANTS);
+
+  // The running sum, nil and the constant it's multiplied by.
+  CHECK(chunk.maxStack == 3);
+  CHECK(verifyChunk(&chunk) == 3);
+
+  freeChunk(&chunk);
+  free(source);
+}
+
+// Loads a constant with the shortest instruction that reaches it.
+static void writeLoad(Chunk *chunk, int index, bool wide) {
+  if (index < 256) {
+    writeChunk(chunk, OP_CONSTANT, 1, 1);
+    writeChunk(chunk, (uint8_t) index, 1, 1);
+    return;
+  }
+
+  writeChunk(chunk, wide ? OP_WIDE : OP_CONSTANT_LONG, 1, 1);
+  if (wide)
+    writeChunk(chunk, OP_CONSTANT, 1, 1);
+
+  writeChunk(chunk, (uint8_t) (index & 0xff), 1, 1);
+  writeChunk(chunk, (uint8_t) ((index >> 8) & 0xff), 1, 1);
+  writeChunk(chunk, (uint8_t) ((index >> 16) & 0xff), 1, 1);
+}
+
+// Pushes every constant before adding any of them up, so the stack
+// gets CONSTANTS deep. The ones past 256 alternate between
+// OP_CONSTANT_LONG and OP_WIDE OP_CONSTANT, and the sum ends with a
+// widened superinstruction.
+static void handBuiltChunk() {
+  Chunk chunk;
+  initChunk(&chunk);
+
+  for (int i = 0; i < CONSTANTS; i++)
+    addConstant(&chunk, NUMBER_VAL(i));
+
+  for (int i = 0; i < CONSTANTS; i++)
+    writeLoad(&chunk, i, i % 2 == 0);
+
+  for (int i = 1; i < CONSTANTS; i++)
+    writeChunk(&chunk, OP_ADD, 1, 1);
+
+  writeChunk(&chunk, OP_WIDE, 1, 1);
+  writeChunk(&chunk, OP_ADD_CONSTANT, 1, 1);
+  writeChunk(&chunk, (CONSTANTS - 1) & 0xff, 1, 1);
+  writeChunk(&chunk, (CONSTANTS - 1) >> 8, 1, 1);
+  writeChunk(&chunk, 0, 1, 1);
+  writeChunk(&chunk, OP_RETURN, 1, 1);
+
+  CHECK(verifyChunk(&chunk) == CONSTANTS);
+
+  // The cache doesn't store the depth - it works it out again.
+  chunk.maxStack = CONSTANTS;
+
+  FILE *file = tmpfile();
+  CHECK(file != NULL && writeCachedChunk(file, 0, &chunk));
+
+  if (file != NULL) {
+    size_t size = (size_t) ftell(file);
+    uint8_t *data = malloc(size);
+    rewind(file);
+    CHECK(data != NULL && fread(data, 1, size, file) == size);
+
+    Chunk loaded;
+    initChunk(&loaded);
+    CHECK(readCachedChunk(data, size, 0, &loaded));
+    CHECK(loaded.maxStack == CONSTANTS);
+
+    freeChunk(&loaded);
+    free(data);
+    fclose(file);
+  }
+
+  freeChunk(&chunk);
+}
+
+// Verifies a chunk with [code] and a single constant.
+static int verifyCode(uint8_t *code, int count) {
+  Chunk chunk;
+  initChunk(&chunk);
+  addConstant(&chunk, NUMBER_VAL(1));
+
+  for (int i = 0; i < count; i++)
+    writeChunk(&chunk, code[i], 1, 1);
+
+  int maxStack = verifyChunk(&chunk);
+  freeChunk(&chunk);
+  return maxStack;
+}
+
+#define VERIFY(...) \
+  verifyCode((uint8_t[]) {__VA_ARGS__}, \
+             sizeof ((uint8_t[]) {__VA_ARGS__}))
+
+// Broken code that verifyChunk() has to turn down.
+static void brokenChunks() {
+  CHECK(VERIFY(OP_CONSTANT, 0, OP_RETURN) == 1);
+
+  // A constant past the pool.
+  CHECK(VERIFY(OP_CONSTANT, 1, OP_RETURN) == -1);
+  CHECK(VERIFY(OP_CONSTANT_LONG, 0xff, 0xff, 0x7f, OP_RETURN) == -1);
+  CHECK(VERIFY(OP_WIDE, OP_CONSTANT, 0, 1, 0, OP_RETURN) == -1);
+
+  // An operand running past the end.
+  CHECK(VERIFY(OP_NIL, OP_RETURN, OP_CONSTANT_LONG, 0) == -1);
+
+  // Popping a value that isn't there.
+  CHECK(VERIFY(OP_CONSTANT, 0, OP_ADD, OP_RETURN) == -1);
+  CHECK(VERIFY(OP_RETURN) == -1);
+
+  // Widening an instruction without a 1-byte operand.
+  CHECK(VERIFY(OP_NIL, OP_WIDE, OP_NEGATE, OP_RETURN) == -1);
+  CHECK(VERIFY(OP_WIDE, OP_CONSTANT_LONG, 0, 0, 0, OP_RETURN) == -1);
+
+  // An unknown opcode, and no OP_RETURN at the end.
+  CHECK(VERIFY(OP_NIL, 0xee, OP_RETURN) == -1);
+  CHECK(VERIFY(OP_NIL) == -1);
+  CHECK(VERIFY(OP_NIL, OP_RETURN, OP_NIL) == -1);
+}
+
+int main() {
+  compiledChunk();
+  handBuiltChunk();
+  brokenChunks();
+
+  if (failures > 0) {
+    fprintf(stderr, "tests/chunk.c: %d failed\n", failures);
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,102 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Checks that scanning a stream takes the same memory however long
+// the stream is: a small one and one sixteen times bigger have to
+// peak at the same place.
+//
+// Run it with `make test`, or build it from the repository root:
+//
+//   cc -O2 -I. -o test-stream tests/stream.c memory.c scanner.c simd.c
+
+#include "common.h"
+#include "memory.h"
+#include "scanner.h"
+
+// Lines in the small stream. The big one has 16 times as many.
+#define LINES 20000
+
+// How far apart the two peaks are allowed to be.
+#define SLACK 4096
+
+static int failures = 0;
+
+#define CHECK(condition) \
+  do { \
+    if (!(condition)) { \
+      fprintf(stderr, "%s:%d: failed: %s\n", __FILE__, __LINE__, \
+              #condition); \
+      failures++; \
+    } \
+  } while (false)
+
+// Writes [lines] lines of every kind of token to a temporary file,
+// and returns it rewound. Every line's lexemes are different.
+static FILE *generate(int lines) {
+  FILE *file = tmpfile();
+  if (file == NULL)
+    exit(1);
+
+  for (int i = 0; i < lines; i++) {
+    fprintf(file, "(%d + %d.25) * 2 - \"string %d\" == name%d != !true "
+                  "// line %d\n", i, i, i, i, i);
+  }
+
+  fflush(file);
+  lseek(fileno(file), 0, SEEK_SET);
+  return file;
+}
+
+// Scans [lines] lines from a stream. Returns how many tokens there
+// were.
+static long scanLines(int lines) {
+  FILE *file = generate(lines);
+  initScannerStream(fileno(file));
+
+  long tokens = 0;
+  Token token;
+  do {
+    token = scanToken();
+    tokens++;
+    CHECK(token.type != TOKEN_ERROR);
+  } while (token.type != TOKEN_EOF && token.type != TOKEN_ERROR);
+
+  freeScanner();
+  fclose(file);
+  return tokens;
+}
+
+int main() {
+  enableMemStats();
+
+  long small = scanLines(LINES);
+  MemTotals afterSmall = getMemTotals();
+
+  long big = scanLines(LINES * 16);
+  MemTotals afterBig = getMemTotals();
+
+  size_t smallPeak = afterSmall.peak;
+  size_t bigPeak = afterBig.peak;
+
+  // 14 tokens a line, and the EOF.
+  CHECK(small == LINES * 14L + 1);
+  CHECK(big == LINES * 16 * 14L + 1);
+
+  // The window and a couple of lexeme buffers, whatever the input.
+  CHECK(bigPeak <= smallPeak + SLACK);
+  CHECK(smallPeak < 256 * 1024);
+
+  // And nothing is left behind for the next stream to add to.
+  CHECK(afterBig.allocated - afterBig.freed == 
+        afterSmall.allocated - afterSmall.freed);
+
+  if (failures > 0) {
+    fprintf(stderr, "tests/stream.c: %d failed (peaks %zu and %zu "
+                    "bytes)\n", failures, smallPeak, bigPeak);
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,105 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Checks that a TokenBuffer hands out any token by index - however
+// far past what's been scanned, past the end of the source, and
+// after the ones before it were discarded.
+//
+// Run it with `make test`, or build it from the repository root:
+//
+//   cc -O2 -I. -o test-tokens tests/tokens.c memory.c scanner.c simd.c
+
+#include "common.h"
+#include "scanner.h"
+
+// "1 + 2 + ... + TERMS": a number and a '+' for each term, minus
+// the last '+', then TOKEN_EOF. A few batches' worth.
+#define TERMS 1000
+#define TOKENS (TERMS * 2)
+
+static int failures = 0;
+
+#define CHECK(condition) \
+  do { \
+    if (!(condition)) { \
+      fprintf(stderr, "%s:%d: failed: %s\n", __FILE__, __LINE__, \
+              #condition); \
+      failures++; \
+    } \
+  } while (false)
+
+static char *makeSource() {
+  size_t size = TERMS * 8;
+  char *source = malloc(size);
+  if (source == NULL)
+    exit(1);
+
+  int length = 0;
+  for (int i = 1; i <= TERMS; i++)
+    length += snprintf(source + length, size - length, "%s%d",
+                       i > 1 ? " + " : "", i);
+
+  return source;
+}
+
+// Token [index] is term [index / 2 + 1], or the '+' after it.
+static bool isTokenAt(Token token, int index) {
+  if (index % 2 == 1)
+    return token.type == TOKEN_PLUS && token.length == 1;
+
+  char lexeme[16];
+  int length = snprintf(lexeme, sizeof (lexeme), "%d", index / 2 + 1);
+
+  return token.type == TOKEN_NUMBER && token.length == length &&
+         memcmp(token.start, lexeme, length) == 0;
+}
+
+int main() {
+  char *source = makeSource();
+
+  TokenBuffer tokens;
+  initTokenBuffer(&tokens, source);
+
+  // Straight to a token a few batches in, before anything is scanned.
+  CHECK(isTokenAt(getToken(&tokens, 1500), 1500));
+  CHECK(getTokenType(&tokens, 1501) == TOKEN_PLUS);
+
+  // Nothing was discarded, so the start is still there.
+  CHECK(isTokenAt(getToken(&tokens, 0), 0));
+
+  // Past the end is TOKEN_EOF, over and over.
+  CHECK(getTokenType(&tokens, TOKENS - 1) == TOKEN_EOF);
+  CHECK(getTokenType(&tokens, TOKENS + 100) == TOKEN_EOF);
+
+  freeTokenBuffer(&tokens);
+
+  // Walking through like the parser does, discarding as it goes,
+  // with a look further ahead at every step.
+  initTokenBuffer(&tokens, source);
+
+  for (int i = 0; i < TOKENS - 1; i++) {
+    discardTokens(&tokens, i);
+    CHECK(isTokenAt(getToken(&tokens, i), i));
+
+    int ahead = i + 300 < TOKENS - 1 ? i + 300 : TOKENS - 1;
+    CHECK(getTokenLine(&tokens, ahead) == 1);
+  }
+
+  // The buffer never held much more than a batch and the lookahead.
+  CHECK(tokens.capacity <= 1024);
+
+  // Discarded tokens are gone, and say so.
+  CHECK(getTokenType(&tokens, 0) == TOKEN_ERROR);
+  CHECK(getTokenLine(&tokens, 0) == 0);
+
+  freeTokenBuffer(&tokens);
+  free(source);
+
+  if (failures > 0) {
+    fprintf(stderr, "tests/tokens.c: %d failed\n", failures);
+    return 1;
+  }
+
+  return 0;
+}
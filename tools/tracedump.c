@@ -0,0 +1,116 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+// Decodes an execution trace written by `loxim --trace path`: every
+// instruction still in the ring buffer, oldest first, with how deep
+// the stack was when it ran, disassembled against the chunk the
+// trace carries.
+//
+// Build it with `make tools`, or from the repository root:
+//
+//   cc -O2 -I. -o tracedump tools/tracedump.c cache.c chunk.c debug.c
+//      memory.c object.c trace.c value.c
+//
+// Then run `./tracedump trace.bin`. Each line is the event's number,
+// the stack depth, and the instruction as debug.c prints it:
+//
+//       1041 [  2] 0006    3   9 OP_DIVIDE_CONSTANT    2 '7'
+
+#include "common.h"
+#include "chunk.h"
+#include "debug.h"
+#include "object.h"
+#include "trace.h"
+
+static uint8_t *readWholeFile(char *path, size_t *size) {
+  FILE *file = fopen(path, "rb");
+  if (file == NULL)
+    return NULL;
+
+  fseek(file, 0L, SEEK_END);
+  *size = ftell(file);
+  rewind(file);
+
+  uint8_t *data = malloc(*size);
+  if (data == NULL || fread(data, 1, *size, file) < *size) {
+    free(data);
+    fclose(file);
+    return NULL;
+  }
+
+  fclose(file);
+  return data;
+}
+
+int main(int argc, char **argv) {
+  if (argc != 2) {
+    fprintf(stderr, "Usage: tracedump trace\n");
+    return 64;
+  }
+
+  size_t size;
+  uint8_t *data = readWholeFile(argv[1], &size);
+
+  if (data == NULL) {
+    fprintf(stderr, "Could not read \"%s\".\n", argv[1]);
+    return 74;
+  }
+
+  TraceHeader header;
+  TraceEvent *events;
+  Chunk chunk;
+  initChunk(&chunk);
+
+  if (!readTrace(data, size, &header, &events, &chunk)) {
+    fprintf(stderr, "\"%s\" isn't a trace, or it's broken.\n", argv[1]);
+    free(data);
+    return 65;
+  }
+
+  // Where each instruction starts. readTrace() verified the chunk,
+  // so the code decodes all the way through.
+  bool *starts = calloc(chunk.count, sizeof (bool));
+  if (starts == NULL)
+    exit(1);
+
+  for (int offset = 0; offset < chunk.count;) {
+    uint8_t instruction;
+    int operand;
+
+    starts[offset] = true;
+    offset += decodeInstruction(&chunk, offset, &instruction, &operand);
+  }
+
+  printf("== %u of %llu instructions ==\n", header.count,
+         (unsigned long long) header.total);
+
+  uint64_t first = header.total - header.count;
+
+  for (uint32_t i = 0; i < header.count; i++) {
+    TraceEvent *event = &events[i];
+    uint8_t instruction = event->info & 0xff;
+    uint32_t depth = event->info >> 8;
+
+    printf("%10llu [%3u%s] ", (unsigned long long) (first + i), depth,
+           depth == TRACE_MAX_DEPTH ? "+" : "");
+
+    // Only trust the event as far as it agrees with the chunk: it
+    // has to point at the start of an instruction, and the same one.
+    if (event->offset >= (uint32_t) chunk.count ||
+        !starts[event->offset] ||
+        chunk.code[event->offset] != instruction) {
+
+      printf("%04u %s (not in the chunk)\n", event->offset,
+             opcodeName(instruction));
+      continue;
+    }
+
+    disassembleInstruction(&chunk, (int) event->offset);
+  }
+
+  free(starts);
+  freeChunk(&chunk);
+  freeObjects();
+  free(data);
+  return 0;
+}
@@ -0,0 +1,63 @@
+#include <string.h>
+
+#include "cache.h"
+#include "trace.h"
+
+bool writeTrace(Trace *trace, Chunk *chunk, char *path) {
+  FILE *file = fopen(path, "wb");
+  if (file == NULL)
+    return false;
+
+  uint64_t count = trace->count < TRACE_CAPACITY ? trace->count
+                                                  : TRACE_CAPACITY;
+
+  TraceHeader header;
+  memset(&header, 0, sizeof (TraceHeader));
+  header.magic = TRACE_MAGIC;
+  header.version = TRACE_VERSION;
+  header.total = trace->count;
+  header.count = (uint32_t) count;
+
+  bool ok = fwrite(&header, sizeof (TraceHeader), 1, file) == 1;
+
+  // Oldest first - the ring buffer might have wrapped around.
+  for (uint64_t i = trace->count - count; ok && i < trace->count; i++) {
+    ok = fwrite(&trace->events[i & (TRACE_CAPACITY - 1)],
+                sizeof (TraceEvent), 1, file) == 1;
+  }
+
+  // There's no source to check the chunk against, so it goes in
+  // with a hash of 0.
+  ok = ok && writeCachedChunk(file, 0, chunk);
+  ok = fclose(file) == 0 && ok;
+
+  if (!ok)
+    remove(path);
+
+  return ok;
+}
+
+bool readTrace(uint8_t *data, size_t size, TraceHeader *header,
+               TraceEvent **events, Chunk *chunk) {
+
+  if (size < sizeof (TraceHeader))
+    return false;
+
+  memcpy(header, data, sizeof (TraceHeader));
+
+  if (header->magic != TRACE_MAGIC || header->version != TRACE_VERSION ||
+      header->count > TRACE_CAPACITY || header->count > header->total) {
+
+    return false;
+  }
+
+  size_t eventsSize = sizeof (TraceEvent) * header->count;
+  if (size < sizeof (TraceHeader) + eventsSize)
+    return false;
+
+  *events = (TraceEvent *) (data + sizeof (TraceHeader));
+
+  uint8_t *rest = data + sizeof (TraceHeader) + eventsSize;
+  return readCachedChunk(rest, size - sizeof (TraceHeader) - eventsSize,
+                         0, chunk);
+}
\ No newline at end of file
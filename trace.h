@@ -0,0 +1,90 @@
+#ifndef CLOXIM_TRACE_H
+#define CLOXIM_TRACE_H
+
+#include <stdio.h>
+
+#include "chunk.h"
+#include "common.h"
+
+// A record of the last instructions a VM ran, cheap enough to leave
+// on in production. Each instruction is one small binary event in a
+// fixed-size ring buffer - nothing is formatted or printed until the
+// trace is written out, and decoded with tools/tracedump.c.
+
+// One instruction, recorded just before it ran.
+typedef struct {
+  // Where it is in the chunk.
+  uint32_t offset;
+
+  // The opcode in the low byte, and how many values were on the
+  // stack in the rest - up to TRACE_MAX_DEPTH, which stands for
+  // that many or more.
+  uint32_t info;
+} TraceEvent;
+
+#define TRACE_MAX_DEPTH 0xffffff
+
+// How many events the ring buffer holds. A power of two.
+#define TRACE_CAPACITY 4096
+
+typedef struct {
+  TraceEvent events[TRACE_CAPACITY];
+
+  // How many events were recorded since the chunk started running.
+  // Only the last TRACE_CAPACITY of them are still in [events].
+  uint64_t count;
+} Trace;
+
+// A written trace file:
+//
+// [TraceHeader]
+// [events]  TraceEvent * header.count, oldest first
+// [chunk]   the chunk the events are from, in cache format
+#define TRACE_MAGIC   0x54584f4c // "LOXT"
+#define TRACE_VERSION 1
+
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+
+  // Every event recorded, including the ones that were overwritten.
+  uint64_t total;
+
+  // The events in the file.
+  uint32_t count;
+  uint32_t reserved;
+} TraceHeader;
+
+// Gets ready for a chunk to start running.
+static inline void startTrace(Trace *trace) {
+  trace->count = 0;
+}
+
+// Called by the VM just before it runs the instruction at [offset].
+static inline void traceInstruction(Trace *trace, int offset,
+                                    uint8_t instruction, int depth) {
+
+  TraceEvent *event = &trace->events[trace->count++ &
+                                     (TRACE_CAPACITY - 1)];
+
+  if (depth > TRACE_MAX_DEPTH)
+    depth = TRACE_MAX_DEPTH;
+
+  event->offset = (uint32_t) offset;
+  event->info = instruction | (uint32_t) depth << 8;
+}
+
+// Writes what's in the ring buffer to [path], along with [chunk],
+// which must be the chunk that was running. Returns false if it
+// couldn't be written.
+bool writeTrace(Trace *, Chunk *, char *path);
+
+// Reads a trace file [size] bytes long. [events] ends up pointing
+// into [data], and [chunk] - initialized, and empty - gets the chunk.
+// Returns false if it isn't a trace file, or a broken one - the
+// chunk is loaded like a cache, so its code is verified too. The
+// events aren't checked against it.
+bool readTrace(uint8_t *data, size_t size, TraceHeader *header,
+               TraceEvent **events, Chunk *chunk);
+
+#endif
\ No newline at end of file
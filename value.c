@@ -1,6 +1,8 @@
 #include <stdio.h>
+#include <string.h>
 
 #include "memory.h"
+#include "object.h"
 #include "value.h"
 
 // These functions are very similar to chunk.c functions.
@@ -10,6 +12,7 @@ void initValueArray(ValueArray *array) {
   array->values = NULL;
   array->capacity = 0;
   array->count = 0;
+  array->arena = NULL;
 }
 
 void writeValueArray(ValueArray *array, Value value) {
@@ -19,8 +22,8 @@ void writeValueArray(ValueArray *array, Value value) {
     array->capacity = GROW_CAPACITY(oldCapacity);
 
     // Now grow the array.
-    array->values = GROW_ARRAY(Value, array->values,
-                               oldCapacity, array->capacity);
+    array->values = GROW_ARRAY_IN(array->arena, Value, array->values,
+                                  oldCapacity, array->capacity);
 
   }
 
@@ -30,13 +33,72 @@ void writeValueArray(ValueArray *array, Value value) {
 
 void freeValueArray(ValueArray *array) {
   // Free the array itself.
-  FREE_ARRAY(Value, array->values, array->capacity);
+  FREE_ARRAY_IN(array->arena, Value, array->values, array->capacity);
 
   // Zero it out.
   initValueArray(array);
 }
 
+bool isFalsey(Value value) {
+  return IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value));
+}
+
+// The bits that identify a constant.
+static uint64_t constantBits(Value value) {
+#ifdef NAN_BOXING
+  return value;
+#else
+  if (IS_BOOL(value))
+    return AS_BOOL(value) ? 1 : 2;
+
+  if (IS_NIL(value))
+    return 3;
+
+  if (IS_OBJ(value))
+    return (uint64_t) (uintptr_t) AS_OBJ(value);
+
+  uint64_t bits;
+  double number = AS_NUMBER(value);
+  memcpy(&bits, &number, sizeof (double));
+  return bits;
+#endif
+}
+
+bool constantsEqual(Value a, Value b) {
+#ifndef NAN_BOXING
+  if (a.type != b.type)
+    return false;
+#endif
+
+  return constantBits(a) == constantBits(b);
+}
+
+uint32_t hashConstant(Value value) {
+  // Strings already hashed their characters when they were made.
+  // Hashing those rather than the pointer keeps the table's layout
+  // the same from run to run.
+  if (IS_STRING(value))
+    return AS_STRING(value)->hash;
+
+  // Fibonacci hashing - the multiply spreads the bits that differ
+  // between nearby numbers (mostly the low mantissa bits, and the
+  // exponent) over the top 32.
+  return (uint32_t) ((constantBits(value) * 0x9e3779b97f4a7c15u) >> 32);
+}
+
 void printValue(Value value) {
+#ifdef NAN_BOXING
+  // There's no type field to switch on.
+  if (IS_BOOL(value)) {
+    printf(AS_BOOL(value) ? "true" : "false");
+  } else if (IS_NIL(value)) {
+    printf("nil");
+  } else if (IS_NUMBER(value)) {
+    printf("%g", AS_NUMBER(value));
+  } else if (IS_OBJ(value)) {
+    printObject(value);
+  }
+#else
   switch (value.type) {
     case VAL_NUMBER:  
       printf("%g", AS_NUMBER(value));
@@ -52,5 +114,10 @@ void printValue(Value value) {
     case VAL_NIL:
       printf("nil"); 
       break;
+
+    case VAL_OBJ:
+      printObject(value);
+      break;
   }
+#endif
 }
\ No newline at end of file
@@ -2,14 +2,78 @@
 #define CLOXIM_VALUE_H
 
 #include "common.h"
+#include "memory.h"
 
-// It's just a double for now. It will become
-// more complex later.
+typedef struct Obj Obj;
+typedef struct ObjString ObjString;
+
+#ifdef NAN_BOXING
+
+#include <string.h>
+
+// A Value is the bit pattern of a double. Numbers are stored
+// as-is, everything else lives inside a quiet NaN:
+//
+//  sign   exponent (all 1s)   quiet   tag
+//   [0]   [11111111111]       [11]    [...................01]
+//
+// No arithmetic operation ever produces a NaN with those two
+// quiet bits set, so they can't be mistaken for a number.
+//
+// Objects set the sign bit too, and keep their pointer in the low
+// 48 bits - all a pointer needs on the machines we run on.
+typedef uint64_t Value;
+
+#define SIGN_BIT  ((uint64_t) 0x8000000000000000)
+#define QNAN      ((uint64_t) 0x7ffc000000000000)
+
+// Tags for the singleton values.
+#define TAG_NIL   1 // 01.
+#define TAG_FALSE 2 // 10.
+#define TAG_TRUE  3 // 11.
+
+#define FALSE_VAL         ((Value) (uint64_t) (QNAN | TAG_FALSE))
+#define TRUE_VAL          ((Value) (uint64_t) (QNAN | TAG_TRUE))
+
+#define AS_BOOL(value)    ((value) == TRUE_VAL)
+#define AS_NUMBER(value)  valueToNum(value)
+#define AS_OBJ(value) \
+    ((Obj *) (uintptr_t) ((value) & ~(SIGN_BIT | QNAN)))
+
+#define BOOL_VAL(b)       ((b) ? TRUE_VAL : FALSE_VAL)
+#define NIL_VAL           ((Value) (uint64_t) (QNAN | TAG_NIL))
+#define NUMBER_VAL(num)   numToValue(num)
+#define OBJ_VAL(obj) \
+    ((Value) (SIGN_BIT | QNAN | (uint64_t) (uintptr_t) (obj)))
+
+// true and false only differ in their lowest bit.
+#define IS_BOOL(value)    (((value) | 1) == TRUE_VAL)
+#define IS_NIL(value)     ((value) == NIL_VAL)
+#define IS_NUMBER(value)  (((value) & QNAN) != QNAN)
+#define IS_OBJ(value) \
+    (((value) & (QNAN | SIGN_BIT)) == (QNAN | SIGN_BIT))
+
+// memcpy() is the portable way of reinterpreting the bits - 
+// compilers turn it into a plain register move.
+static inline double valueToNum(Value value) {
+  double num;
+  memcpy(&num, &value, sizeof (Value));
+  return num;
+}
+
+static inline Value numToValue(double num) {
+  Value value;
+  memcpy(&value, &num, sizeof (double));
+  return value;
+}
+
+#else
 
 typedef enum {
   VAL_BOOL,
   VAL_NIL,
-  VAL_NUMBER
+  VAL_NUMBER,
+  VAL_OBJ
 } ValueType;
 
 typedef struct {
@@ -19,25 +83,34 @@ typedef struct {
   union {
     bool boolean;
     double number;
+    Obj *obj;
   } as;
 } Value;
 
 #define AS_BOOL(value)    ((value).as.boolean)
 #define AS_NUMBER(value)  ((value).as.number)
+#define AS_OBJ(value)     ((value).as.obj)
 
 #define BOOL_VAL(value)   ((Value) {VAL_BOOL, {.boolean = value}})
 #define NIL_VAL           ((Value) {VAL_NIL, {.number = 0}})
 #define NUMBER_VAL(value) ((Value) {VAL_NUMBER, {.number = value}})
+#define OBJ_VAL(object)   ((Value) {VAL_OBJ, {.obj = (Obj *) (object)}})
 
 #define IS_BOOL(value)    ((value).type == VAL_BOOL)
 #define IS_NIL(value)     ((value).type == VAL_NIL)
 #define IS_NUMBER(value)  ((value).type == VAL_NUMBER)
+#define IS_OBJ(value)     ((value).type == VAL_OBJ)
+
+#endif
 
 // Our constant pool.
 typedef struct {
   int capacity;
   int count;
   Value *values;
+
+  // Where [values] is allocated. NULL for the heap.
+  Arena *arena;
 } ValueArray;
 
 // Initializes a value array
@@ -49,6 +122,41 @@ void writeValueArray(ValueArray *, Value);
 // Frees the array and zeroes it out.
 void freeValueArray(ValueArray *);
 
+// nil and false are falsey, everything else is truthy.
+bool isFalsey(Value);
+
+// Whether two values are equal, for ==. Strings are interned, so
+// equal strings are always the same object, and every object is
+// compared by its pointer.
+static inline bool valuesEqual(Value a, Value b) {
+#ifdef NAN_BOXING
+  // NaN isn't equal to itself, so numbers can't just compare bits.
+  if (IS_NUMBER(a) && IS_NUMBER(b))
+    return AS_NUMBER(a) == AS_NUMBER(b);
+
+  return a == b;
+#else
+  if (a.type != b.type)
+    return false;
+
+  switch (a.type) {
+    case VAL_BOOL:   return AS_BOOL(a) == AS_BOOL(b);
+    case VAL_NIL:    return true;
+    case VAL_NUMBER: return AS_NUMBER(a) == AS_NUMBER(b);
+    case VAL_OBJ:    return AS_OBJ(a) == AS_OBJ(b);
+    default:         return false;
+  }
+#endif
+}
+
+// Whether two values are the same constant. Numbers are compared
+// bit for bit, so unlike ==, NaN matches itself and 0 doesn't
+// match -0 - the two print differently.
+bool constantsEqual(Value, Value);
+
+// Hashes a value the way constantsEqual() compares it.
+uint32_t hashConstant(Value);
+
 // Prints a value.
 void printValue(Value);
 
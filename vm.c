@@ -3,192 +3,514 @@
 
 #include "common.h"
 #include "compiler.h"
+#include "memory.h"
+#include "scanner.h"
 #include "vm.h"
 #include "debug.h"
 
-// Our global VM.
-VM vm;
+// The VM behind the global-style API.
+static VM defaultVM;
 
 // Helper functions.
-static void resetStack() {
+static void resetStack(VM *vm) {
   // Make the stack top point to the first
   // stack slot.
-  vm.stackTop = vm.stack;
+  vm->stackTop = vm->stack;
 }
 
-static void runtimeError(char *format, ...) {
+// Makes room for at least [slots] more values on top of what's
+// on the stack already.
+static void ensureStack(VM *vm, int slots) {
+  int depth = (int) (vm->stackTop - vm->stack);
+  int needed = depth + slots;
+
+  if (needed <= vm->stackCapacity)
+    return;
+
+  int oldCapacity = vm->stackCapacity;
+  while (vm->stackCapacity < needed)
+    vm->stackCapacity = GROW_CAPACITY(vm->stackCapacity);
+
+  vm->stack = GROW_ARRAY(Value, vm->stack, oldCapacity, vm->stackCapacity);
+
+  // The stack might have moved.
+  vm->stackTop = vm->stack + depth;
+}
+
+static void runtimeError(VM *vm, char *format, ...) {
   // Using variadic arguments to format *format.
   // Make the list stuff
   va_list args;
   va_start(args, format);
   
+  FILE *out = vm->errors;
+
   // Print the format string
-  fprintf(stderr, "Runtime error: ");
-  vfprintf(stderr, format, args);
+  fprintf(out, "Runtime error: ");
+  vfprintf(out, format, args);
 
   // Get the line and column
-  size_t instruction = vm.ip - vm.chunk->code - 1;
-  int lineNumber = getLine(vm.chunk, instruction);
-  int column = vm.chunk->columns[instruction];
+  size_t instruction = vm->ip - vm->chunk->code - 1;
+  Position position = getPosition(vm->chunk, (int) instruction);
+  int lineNumber = position.line;
+  int column = position.column;
 
   // Print the line info
-  fprintf(stderr, "\nLine %d, column %d", lineNumber, column);
-  fputs("\n", stderr);
+  fprintf(out, "\nLine %d, column %d", lineNumber, column);
+  fputs("\n", out);
+
+  // Chunks loaded from a cache might not come with their source.
+  if (vm->source == NULL)
+    return;
 
   // Retrieve the line where the error occured
-  // Note: this function is defined in compiler.c
-  char *line = getOffendingLine(lineNumber);
+  // Note: this function is defined in scanner.c
+  int lineLength;
+  char *line = getOffendingLine(vm->source, lineNumber, &lineLength);
+
+  if (line == NULL)
+    return;
 
   // Print it
-  fprintf(stderr, "%5d | %s\n", lineNumber, line);
+  fprintf(out, "%5d | %.*s\n", lineNumber, lineLength, line);
   // Show the caret (^-- Here.)
-  fprintf(stderr, "%*s", 7 + column, "");
+  fprintf(out, "%*s", 7 + column, "");
   //                     ^^^^^^^^^^-- distance - amount of spaces.
 
   // Since we added enough spaces, we can now just print the ^-- Here. message.
-  fprintf(stderr, "^-- Here.\n");
+  fprintf(out, "^-- Here.\n");
 }
 
 // Stack functions.
-void push(Value value) {
-  *vm.stackTop = value;
+void vmPush(VM *vm, Value value) {
+  ensureStack(vm, 1);
+  *vm->stackTop = value;
 
   // Advance the stackTop pointer.
-  vm.stackTop++;
+  vm->stackTop++;
 }
 
-Value pop() {
-  vm.stackTop--;
-  return *vm.stackTop;
+Value vmPop(VM *vm) {
+  vm->stackTop--;
+  return *vm->stackTop;
 }
 
-Value peek(int distance) {
-  return vm.stackTop[-1 - distance];
-}
+void vmInit(VM *vm) {
+  vm->errors = stderr;
+  vm->profile = NULL;
+  vm->trace = NULL;
+  vm->stack = NULL;
+  vm->stackCapacity = 0;
+  vm->stackTop = NULL;
 
-void initVM() {
-  resetStack();
+  ensureStack(vm, STACK_INITIAL);
+  resetStack(vm);
 }
 
-void freeVM() {
-
+void vmFree(VM *vm) {
+  FREE_ARRAY(Value, vm->stack, vm->stackCapacity);
+  vm->stack = NULL;
+  vm->stackCapacity = 0;
+  vm->stackTop = NULL;
 }
 
-static InterpretResult run() {
-#define READ_BYTE()     (*vm.ip++)
-#define READ_CONSTANT() (vm.chunk->constants.values[READ_BYTE()])
+static InterpretResult run(VM *vm) {
+  // The hot parts of the VM live in locals while we run, so the C
+  // compiler can keep them in registers instead of reading and
+  // writing the global VM on every instruction. They're only
+  // written back (SAVE_STATE()) when something outside run()
+  // needs to see them.
+  uint8_t *ip = vm->ip;
+  Value *stackTop = vm->stackTop;
+  Value *constants = vm->chunk->constants.values;
+  Profile *profile = vm->profile;
+  Trace *trace = vm->trace;
+  bool isHooked = profile != NULL || trace != NULL;
+
+#define SAVE_STATE()    (vm->ip = ip, vm->stackTop = stackTop)
+#define READ_BYTE()     (*ip++)
+#define READ_CONSTANT() (constants[READ_BYTE()])
+
+// A 3-byte little endian operand, for OP_CONSTANT_LONG and anything
+// behind an OP_WIDE.
+#define READ_LONG() \
+  (ip += 3, (uint32_t) ip[-3] | ((uint32_t) ip[-2] << 8) | \
+            ((uint32_t) ip[-1] << 16))
+
+// Local versions of push(), pop() and peek().
+#define PUSH(value)     (*stackTop++ = (value))
+#define POP()           (*--stackTop)
+#define PEEK(distance)  (stackTop[-1 - (distance)])
+
+#define RUNTIME_ERROR(...) \
+  do { \
+    SAVE_STATE(); \
+    runtimeError(vm, __VA_ARGS__); \
+    return INTERPRET_RUNTIME_ERROR; \
+  } while (false)
+
 #define BINARY_OP(valueType, op) \
   do { \
-    if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) { \
-      runtimeError("Operands must be numbers."); \
-      return INTERPRET_COMPILE_ERROR; \
-    } \
-    double b = AS_NUMBER(pop()); \
-    double a = AS_NUMBER(pop()); \
-    push(valueType(a op b)); \
+    if (!IS_NUMBER(PEEK(0)) || !IS_NUMBER(PEEK(1))) \
+      RUNTIME_ERROR("Operands must be numbers."); \
+    double b = AS_NUMBER(POP()); \
+    double a = AS_NUMBER(POP()); \
+    PUSH(valueType(a op b)); \
+  } while (false)
+
+// For the fused instructions. The compiler only fuses number
+// constants, so only the left operand needs checking.
+#define BINARY_OP_WITH(valueType, op, constant) \
+  do { \
+    Value b = (constant); \
+    if (!IS_NUMBER(PEEK(0))) \
+      RUNTIME_ERROR("Operands must be numbers."); \
+    stackTop[-1] = valueType(AS_NUMBER(stackTop[-1]) op AS_NUMBER(b)); \
   } while (false)
 
-  while (1) {
+#define BINARY_OP_CONSTANT(valueType, op) \
+  BINARY_OP_WITH(valueType, op, READ_CONSTANT())
+
 #ifdef DEBUG_TRACE_EXECUTION
-    // Print the contents of the stack:
-    printf("      ");
-    for (Value *slot = vm.stack; slot < vm.stackTop; slot++) {
-      printf("[ ");
-      printValue(*slot);
-      printf(" ]");
-    }
+#define TRACE_INSTRUCTION() \
+  do { \
+    /* Print the contents of the stack: */ \
+    printf("      "); \
+    for (Value *slot = vm->stack; slot < stackTop; slot++) { \
+      printf("[ "); \
+      printValue(*slot); \
+      printf(" ]"); \
+    } \
+    printf("\n"); \
+    disassembleInstruction(vm->chunk, (int) (ip - vm->chunk->code)); \
+  } while (false)
+#else
+#define TRACE_INSTRUCTION() do { } while (false)
+#endif
+
+// Profiling and tracing, just before the instruction at [offset]
+// runs.
+#define HOOK_INSTRUCTION(offset) \
+  do { \
+    if (profile != NULL) \
+      profileInstruction(profile, (offset)); \
+    if (trace != NULL) \
+      traceInstruction(trace, (offset), vm->chunk->code[offset], \
+                       (int) (stackTop - vm->stack)); \
+  } while (false)
 
-    printf("\n");
-    disassembleInstruction(vm.chunk, (int) 
-                          (vm.ip - vm.chunk->code));
+#ifdef COMPUTED_GOTO
+  // Each instruction jumps straight to the next one's label, so
+  // every opcode gets its own indirect branch instead of all of
+  // them sharing the one at the top of a switch.
+  //
+  // Every byte gets an entry, so a corrupted chunk lands on
+  // op_unknown instead of jumping to garbage.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Woverride-init"
+  static void *dispatchTable[256] = {
+    [0 ... 255]        = &&op_unknown,
+
+    [OP_CONSTANT]      = &&op_OP_CONSTANT,
+    [OP_CONSTANT_LONG] = &&op_OP_CONSTANT_LONG,
+    [OP_NIL]           = &&op_OP_NIL,
+    [OP_TRUE]          = &&op_OP_TRUE,
+    [OP_FALSE]         = &&op_OP_FALSE,
+    [OP_ADD]           = &&op_OP_ADD,
+    [OP_SUBTRACT]      = &&op_OP_SUBTRACT,
+    [OP_MULTIPLY]      = &&op_OP_MULTIPLY,
+    [OP_DIVIDE]        = &&op_OP_DIVIDE,
+    [OP_NOT]           = &&op_OP_NOT,
+    [OP_NEGATE]        = &&op_OP_NEGATE,
+    [OP_EQUAL]         = &&op_OP_EQUAL,
+    [OP_RETURN]        = &&op_OP_RETURN,
+
+    [OP_ADD_CONSTANT]      = &&op_OP_ADD_CONSTANT,
+    [OP_SUBTRACT_CONSTANT] = &&op_OP_SUBTRACT_CONSTANT,
+    [OP_MULTIPLY_CONSTANT] = &&op_OP_MULTIPLY_CONSTANT,
+    [OP_DIVIDE_CONSTANT]   = &&op_OP_DIVIDE_CONSTANT,
+
+    [OP_WIDE]          = &&op_OP_WIDE
+  };
+
+  // Profiling and tracing dispatch through this table instead, 
+  // which sends every instruction through op_hook on its way to its
+  // own label. Without either, the loop is exactly what it'd be
+  // without them at all.
+  static void *hookTable[256] = {
+    [0 ... 255] = &&op_hook
+  };
+#pragma GCC diagnostic pop
+
+  void **table = isHooked ? hookTable : dispatchTable;
+
+#define INTERPRET_LOOP  DISPATCH();
+#define CASE(opcode)    op_##opcode
+#define DEFAULT         op_unknown
+#define DISPATCH() \
+  do { \
+    TRACE_INSTRUCTION(); \
+    goto *table[READ_BYTE()]; \
+  } while (false)
+#else
+#define INTERPRET_LOOP \
+  loop: \
+    TRACE_INSTRUCTION(); \
+    if (isHooked) \
+      HOOK_INSTRUCTION((int) (ip - vm->chunk->code)); \
+    switch (READ_BYTE())
+#define CASE(opcode)    case opcode
+#define DEFAULT         default
+#define DISPATCH()      goto loop
 #endif
+
+  INTERPRET_LOOP {
     // Visit each instruction.
-    uint8_t instruction;
-    switch (instruction = READ_BYTE()) {
-      case OP_CONSTANT: {
-        // The operand:
-        Value constant = READ_CONSTANT();
+    CASE(OP_CONSTANT): {
+      // The operand:
+      Value constant = READ_CONSTANT();
+
+      // Push it onto the stack.
+      PUSH(constant);
+      DISPATCH();
+    }
 
-        // Push it onto the stack.
-        push(constant);
+    CASE(OP_CONSTANT_LONG):
+      // Same thing, for constants past the first 256.
+      PUSH(constants[READ_LONG()]);
+      DISPATCH();
+
+    // Dedicated constant instructions.
+    CASE(OP_NIL):
+      PUSH(NIL_VAL);
+      DISPATCH();
+
+    CASE(OP_TRUE):
+      PUSH(BOOL_VAL(true));
+      DISPATCH();
+
+    CASE(OP_FALSE):
+      PUSH(BOOL_VAL(false));
+      DISPATCH();
+
+    CASE(OP_NOT):
+      stackTop[-1] = BOOL_VAL(isFalsey(stackTop[-1]));
+      DISPATCH();
+
+    CASE(OP_NEGATE):
+      // Negate the top of the stack and return
+      // it.
+      if (!IS_NUMBER(PEEK(0)))
+        RUNTIME_ERROR("Operand must be a number.");
+
+      // Offsetting stackTop by -1 because it always
+      // points to the next slot to be occupied,
+      // if that makes sense.
+      stackTop[-1] = NUMBER_VAL(-AS_NUMBER(stackTop[-1]));
+      DISPATCH();
+
+    CASE(OP_EQUAL): {
+      // Strings are interned, so this never looks at characters.
+      Value b = POP();
+      stackTop[-1] = BOOL_VAL(valuesEqual(stackTop[-1], b));
+      DISPATCH();
+    }
 
-        printf("\n");
-        break;
+    // Binary operations.
+    CASE(OP_ADD):
+      BINARY_OP(NUMBER_VAL, +);
+      DISPATCH();
+
+    CASE(OP_SUBTRACT):
+      BINARY_OP(NUMBER_VAL, -);
+      DISPATCH();
+
+    CASE(OP_MULTIPLY):
+      BINARY_OP(NUMBER_VAL, *);
+      DISPATCH();
+
+    CASE(OP_DIVIDE):
+      BINARY_OP(NUMBER_VAL, /);
+      DISPATCH();
+
+    // Superinstructions.
+    CASE(OP_ADD_CONSTANT):
+      BINARY_OP_CONSTANT(NUMBER_VAL, +);
+      DISPATCH();
+
+    CASE(OP_SUBTRACT_CONSTANT):
+      BINARY_OP_CONSTANT(NUMBER_VAL, -);
+      DISPATCH();
+
+    CASE(OP_MULTIPLY_CONSTANT):
+      BINARY_OP_CONSTANT(NUMBER_VAL, *);
+      DISPATCH();
+
+    CASE(OP_DIVIDE_CONSTANT):
+      BINARY_OP_CONSTANT(NUMBER_VAL, /);
+      DISPATCH();
+
+    CASE(OP_WIDE): {
+      // The widened instructions are rare, so they share this one
+      // entry point instead of each getting a label of their own.
+      uint8_t instruction = READ_BYTE();
+      uint32_t operand = READ_LONG();
+
+      switch (instruction) {
+        case OP_CONSTANT:
+          PUSH(constants[operand]);
+          break;
+
+        case OP_ADD_CONSTANT:
+          BINARY_OP_WITH(NUMBER_VAL, +, constants[operand]);
+          break;
+
+        case OP_SUBTRACT_CONSTANT:
+          BINARY_OP_WITH(NUMBER_VAL, -, constants[operand]);
+          break;
+
+        case OP_MULTIPLY_CONSTANT:
+          BINARY_OP_WITH(NUMBER_VAL, *, constants[operand]);
+          break;
+
+        case OP_DIVIDE_CONSTANT:
+          BINARY_OP_WITH(NUMBER_VAL, /, constants[operand]);
+          break;
+
+        default:
+          RUNTIME_ERROR("Unknown wide opcode %d.", instruction);
       }
 
-      // Dedicated constant instructions.
-      case OP_NIL:
-        push(NIL_VAL);
-        break;
-
-      case OP_TRUE:
-        push(BOOL_VAL(true));
-        break;
-
-      case OP_FALSE:
-        push(BOOL_VAL(false));
-        break;
-
-      case OP_NEGATE:
-        // Negate the top of the stack and return
-        // it.
-        if (!IS_NUMBER(peek(0))) {
-          runtimeError("Operand must be a number.");
-          return INTERPRET_RUNTIME_ERROR;
-        }
-
-        // Offsetting stackTop by -1 because it always
-        // points to the next slot to be occupied,
-        // if that makes sense.
-        vm.stackTop[-1] = NUMBER_VAL(-AS_NUMBER(vm.stackTop[-1]));
-        break;
-
-      // Binary operations.
-      case OP_ADD:
-        BINARY_OP(NUMBER_VAL, +);
-        break;
-
-      case OP_SUBTRACT:
-        BINARY_OP(NUMBER_VAL, -);
-        break;
-
-      case OP_MULTIPLY:
-        BINARY_OP(NUMBER_VAL, *);
-        break;
-
-      case OP_DIVIDE:
-        BINARY_OP(NUMBER_VAL, /);
-        break;
-
-      case OP_RETURN:
-        // Prints the top of the stack
-        // (for now, of course).
-        printValue(pop());
-        printf("\n");
-        return INTERPRET_OK;
+      DISPATCH();
     }
+
+    CASE(OP_RETURN):
+      // Prints the top of the stack
+      // (for now, of course).
+      printValue(POP());
+      printf("\n");
+      SAVE_STATE();
+      return INTERPRET_OK;
+
+#ifdef COMPUTED_GOTO
+    op_hook:
+      // The opcode has been read already.
+      HOOK_INSTRUCTION((int) (ip - 1 - vm->chunk->code));
+      goto *dispatchTable[ip[-1]];
+#endif
+
+    DEFAULT:
+      // The compiler never emits an instruction we can't run,
+      // but a corrupted chunk might.
+      RUNTIME_ERROR("Unknown opcode %d.", ip[-1]);
   }
 
+  // Unreachable.
+  return INTERPRET_RUNTIME_ERROR;
+
+#undef SAVE_STATE
 #undef READ_BYTE
 #undef READ_CONSTANT
+#undef PUSH
+#undef POP
+#undef PEEK
+#undef RUNTIME_ERROR
 #undef BINARY_OP
+#undef BINARY_OP_WITH
+#undef BINARY_OP_CONSTANT
+#undef READ_LONG
+#undef TRACE_INSTRUCTION
+#undef HOOK_INSTRUCTION
+#undef INTERPRET_LOOP
+#undef CASE
+#undef DEFAULT
+#undef DISPATCH
 }
 
-InterpretResult interpret(char *source) {
-  Chunk chunk;
-  initChunk(&chunk);
+InterpretResult vmInterpretChunk(VM *vm, Chunk *chunk, char *source) {
+  vm->chunk = chunk;
+  vm->source = source;
+  vm->ip = vm->chunk->code;
 
-  if (!compile(source, &chunk)) {
-    // Error.
-    freeChunk(&chunk);
-    return INTERPRET_COMPILE_ERROR;
-  }
+  // If the chunk was just compiled from [source] on this thread, the
+  // scanner's line index is still good. Otherwise whatever it indexed
+  // might be gone, with [source] sitting where it was - and a cached
+  // chunk's source was never scanned at all.
+  useLineIndex(source, chunk->lineIndexStamp);
+
+  // Whatever a failed run left behind is garbage now.
+  resetStack(vm);
+
+  // The compiler worked out how deep this chunk's stack gets, so
+  // making room for that up front means run() never has to check
+  // before pushing.
+  ensureStack(vm, chunk->maxStack);
+
+  if (vm->profile == NULL && vm->trace == NULL)
+    return run(vm);
+
+  if (vm->profile != NULL)
+    startProfile(vm->profile, chunk);
+
+  if (vm->trace != NULL)
+    startTrace(vm->trace);
 
-  vm.chunk = &chunk;
-  vm.ip = vm.chunk->code;
+  InterpretResult result = run(vm);
 
-  InterpretResult result = run();
+  if (vm->profile != NULL)
+    endProfile(vm->profile, chunk);
+
+  return result;
+}
+
+InterpretResult vmInterpret(VM *vm, char *source) {
+  // The chunk only lives until it has run, so everything in it
+  // comes out of an arena and goes back in one go.
+  Arena arena;
+  initArena(&arena);
+
+  Chunk chunk;
+  initChunk(&chunk);
+  setChunkArena(&chunk, &arena);
+
+  InterpretResult result = INTERPRET_COMPILE_ERROR;
+  if (compile(source, &chunk))
+    result = vmInterpretChunk(vm, &chunk, source);
 
   freeChunk(&chunk);
+  freeArena(&arena);
   return result;
-}
\ No newline at end of file
+}
+
+// The global-style API - the same thing, on defaultVM.
+void initVM() {
+  vmInit(&defaultVM);
+}
+
+void freeVM() {
+  vmFree(&defaultVM);
+}
+
+InterpretResult interpret(char *source) {
+  return vmInterpret(&defaultVM, source);
+}
+
+InterpretResult interpretChunk(Chunk *chunk, char *source) {
+  return vmInterpretChunk(&defaultVM, chunk, source);
+}
+
+void setProfile(Profile *profile) {
+  defaultVM.profile = profile;
+}
+
+void setTrace(Trace *trace) {
+  defaultVM.trace = trace;
+}
+
+void push(Value value) {
+  vmPush(&defaultVM, value);
+}
+
+Value pop() {
+  return vmPop(&defaultVM);
+}
@@ -1,22 +1,44 @@
 #ifndef CLOXIM_VM_H
 #define CLOXIM_VM_H
 
+#include <stdio.h>
+
 #include "chunk.h"
+#include "profiler.h"
+#include "trace.h"
 #include "value.h"
 
-#define STACK_MAX 256
+// How many slots a VM's stack starts with. It grows from there.
+#define STACK_INITIAL 64
 
 // Our virtual machine - the thing that will
 // execute code. Beware!
 typedef struct {
   Chunk *chunk;
+
+  // The source code [chunk] was compiled from, for error
+  // messages. Might be NULL.
+  char *source;
   
   // Instruction ptr.
   uint8_t *ip;
 
-  // The VM's stack.
-  Value stack[STACK_MAX];
+  // The VM's stack. It lives on the heap and grows as needed, so
+  // [stackTop] has to be fixed up whenever it moves.
+  Value *stack;
+  int stackCapacity;
   Value *stackTop;
+
+  // Where runtime errors are reported. vmInit() sets it to stderr.
+  FILE *errors;
+
+  // While this is set, every instruction the VM runs is counted and
+  // timed in it. NULL by default, which costs nothing.
+  Profile *profile;
+
+  // The same, for recording what ran into a trace. Whoever set it
+  // writes it out when they want to - after a runtime error, say.
+  Trace *trace;
 } VM;
 
 // If execution was successful or not.
@@ -26,8 +48,31 @@ typedef enum {
   INTERPRET_RUNTIME_ERROR
 } InterpretResult;
 
-// Since our VM is a global variable, we don't
-// need to worry about parameters.
+// Every VM is separate from every other one, so each thread can
+// run scripts on its own VM at the same time.
+
+// Sets up a VM to run code.
+void vmInit(VM *vm);
+
+// Winds down a VM.
+void vmFree(VM *vm);
+
+// Compiles and runs a piece of source code.
+InterpretResult vmInterpret(VM *vm, char *source);
+
+// Runs an already compiled chunk. The chunk still belongs
+// to the caller, and isn't changed by running it, so several VMs
+// can share one. [source] is only used to show the offending line
+// in runtime errors, and can be NULL.
+InterpretResult vmInterpretChunk(VM *vm, Chunk *chunk, char *source);
+
+// Stack functions.
+void vmPush(VM *vm, Value value);
+
+Value vmPop(VM *vm);
+
+// The same functions, on one global VM. Handy when there's only
+// ever one VM, like in main.c.
 
 // Initializes the VM.
 void initVM();
@@ -38,7 +83,17 @@ void freeVM();
 // Runs a chunk of bytecode.
 InterpretResult interpret(char *source);
 
-// Stack functions.
+// Runs an already compiled chunk. See vmInterpretChunk().
+InterpretResult interpretChunk(Chunk *chunk, char *source);
+
+// Profiles everything the VM runs from now on into [profile], or
+// stops profiling if it's NULL.
+void setProfile(Profile *profile);
+
+// Traces everything the VM runs from now on into [trace], or stops
+// tracing if it's NULL.
+void setTrace(Trace *trace);
+
 void push(Value value);
 
 Value pop();